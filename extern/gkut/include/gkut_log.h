@@ -31,6 +31,10 @@ void gk_print_log(const char *fmt, ...);
  * Must call init_log at some point before calling this to print to logfile.
  */
 
+void gk_flush_log();
+/* Flushes stdout and the logfile.
+ */
+
 void gk_log_fatal(int fatal_errno, const char *file, int line, const char *fmt, ...);
 /* Logs fatal error to logfile and also calls gmx_fatal
  * Hint: Use FARGS for first 3 arguments.
@@ -50,6 +50,13 @@ void gk_print_log(char const *fmt, ...) {
 	}
 }
 
+void gk_flush_log() {
+	fflush(stdout);
+	if(out_log != NULL) {
+		fflush(out_log);
+	}
+}
+
 void gk_log_fatal(int fatal_errno, const char *file, int line, char const *fmt, ...) {
 	va_list arg;
 
@@ -7,6 +7,14 @@
 #include <stdarg.h>
 #include <limits.h>
 #include <locale.h>
+#include <sys/time.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+// The AVX2 and F16C paths are built into every x86 binary and chosen at
+// run time (see simd_ok), so that one build runs on any x86 node
+#define SVM_SIMD
+#define SIMD_TARGET __attribute__((target("avx2,f16c")))
+#endif
 #include "svm.h"
 int libsvm_version = LIBSVM_VERSION;
 typedef float Qfloat;
@@ -58,102 +66,184 @@ static void info(const char *fmt,...)
 static void info(const char *fmt,...) {}
 #endif
 
+#ifdef SVM_SIMD
+static bool cpu_has_simd()
+{
+#if defined(__AVX2__) && defined(__F16C__)
+	return true;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c");
+#endif
+}
+
+static const bool simd_ok = cpu_has_simd();
+#endif
+
 //
 // Kernel Cache
 //
 // l is the number of total data items
 // size is the cache size limit in bytes
+// T is the stored element type, Qfloat or Qhalf
+// policy chooses the column to evict when the cache is full:
+//   CACHE_LRU	the least recently used column
+//   CACHE_LFU	the least frequently used of the LFU_SAMPLE least recently
+//		used columns; the others have their counts halved, so
+//		columns that stop being used age out
+//   CACHE_SV	the least recently used column that is not pinned. The
+//		solver pins the columns of free SVs, which SMO keeps
+//		revisiting, while it streams through bounded ones.
 //
-class Cache
+#define LFU_SAMPLE 8
+
+template <class T> class CacheT
 {
 public:
-	Cache(int l,long int size);
-	~Cache();
+	CacheT(int l,long int size,int policy = CACHE_LRU);
+	~CacheT();
 
 	// request data [0,len)
 	// return some position p where [p,len) need to be filled
 	// (p >= len if nothing needs to be filled)
-	int get_data(const int index, Qfloat **data, int len);
+	int get_data(const int index, T **data, int len);
 	void swap_index(int i, int j);
+	void set_pinned(int index, bool pinned);
+	int cached_len(int index) const { return head[index].len; }
+
+	long hits, misses, evictions;
 private:
 	int l;
 	long int size;
+	int policy;
 	struct head_t
 	{
 		head_t *prev, *next;	// a circular list
-		Qfloat *data;
+		T *data;
 		int len;		// data[0,len) is cached in this entry
+		unsigned int freq;	// number of requests, for CACHE_LFU
+		bool pinned;		// kept in pin_head's list, for CACHE_SV
 	};
 
 	head_t *head;
 	head_t lru_head;
+	head_t pin_head;	// pinned columns, evicted only if all are pinned
+	head_t *last;		// most recently requested column
 	void lru_delete(head_t *h);
 	void lru_insert(head_t *h);
+	head_t *victim();
+	void free_entry(head_t *h);
 };
 
-Cache::Cache(int l_,long int size_):l(l_),size(size_)
+template <class T> CacheT<T>::CacheT(int l_,long int size_,int policy_):
+hits(0),misses(0),evictions(0),l(l_),size(size_),policy(policy_)
 {
 	head = (head_t *)calloc(l,sizeof(head_t));	// initialized to 0
-	size /= sizeof(Qfloat);
-	size -= l * sizeof(head_t) / sizeof(Qfloat);
+	size /= sizeof(T);
+	size -= l * sizeof(head_t) / sizeof(T);
 	size = max(size, 2 * (long int) l);	// cache must be large enough for two columns
 	lru_head.next = lru_head.prev = &lru_head;
+	pin_head.next = pin_head.prev = &pin_head;
+	last = NULL;
 }
 
-Cache::~Cache()
+template <class T> CacheT<T>::~CacheT()
 {
 	for(head_t *h = lru_head.next; h != &lru_head; h=h->next)
 		free(h->data);
+	for(head_t *h = pin_head.next; h != &pin_head; h=h->next)
+		free(h->data);
 	free(head);
 }
 
-void Cache::lru_delete(head_t *h)
+template <class T> void CacheT<T>::lru_delete(head_t *h)
 {
 	// delete from current location
 	h->prev->next = h->next;
 	h->next->prev = h->prev;
 }
 
-void Cache::lru_insert(head_t *h)
+template <class T> void CacheT<T>::lru_insert(head_t *h)
 {
 	// insert to last position
-	h->next = &lru_head;
-	h->prev = lru_head.prev;
+	head_t *list = h->pinned? &pin_head : &lru_head;
+	h->next = list;
+	h->prev = list->prev;
 	h->prev->next = h;
 	h->next->prev = h;
 }
 
-int Cache::get_data(const int index, Qfloat **data, int len)
+// The solver uses the previously requested column together with the one
+// being filled, so it is never chosen. It is at the end of its list, but
+// with columns pinned a list can hold it alone, and it is then also the
+// head, so it is skipped explicitly.
+template <class T> typename CacheT<T>::head_t *CacheT<T>::victim()
+{
+	head_t *list = &lru_head;
+	head_t *old = lru_head.next;
+	if(old == last) old = old->next;
+	if(old == &lru_head)	// everything else is pinned
+	{
+		list = &pin_head;
+		old = pin_head.next;
+		if(old == last) old = old->next;
+	}
+	if(policy == CACHE_LFU)
+	{
+		head_t *first = old, *h;
+		int k;
+		for(h = first, k = 0; h != list && k < LFU_SAMPLE; h=h->next, k++)
+			if(h != last && h->freq < old->freq)
+				old = h;
+		for(h = first, k = 0; h != list && k < LFU_SAMPLE; h=h->next, k++)
+			h->freq >>= 1;
+	}
+	return old;
+}
+
+template <class T> void CacheT<T>::free_entry(head_t *h)
+{
+	lru_delete(h);
+	free(h->data);
+	size += h->len;
+	h->data = 0;
+	h->len = 0;
+	h->freq = 0;
+}
+
+template <class T> int CacheT<T>::get_data(const int index, T **data, int len)
 {
 	head_t *h = &head[index];
 	if(h->len) lru_delete(h);
 	int more = len - h->len;
+	++h->freq;
 
 	if(more > 0)
 	{
+		++misses;
+
 		// free old space
 		while(size < more)
 		{
-			head_t *old = lru_head.next;
-			lru_delete(old);
-			free(old->data);
-			size += old->len;
-			old->data = 0;
-			old->len = 0;
+			free_entry(victim());
+			++evictions;
 		}
 
 		// allocate new space
-		h->data = (Qfloat *)realloc(h->data,sizeof(Qfloat)*len);
+		h->data = (T *)realloc(h->data,sizeof(T)*len);
 		size -= more;
 		swap(h->len,len);
 	}
+	else
+		++hits;
 
 	lru_insert(h);
+	last = h;
 	*data = h->data;
 	return len;
 }
 
-void Cache::swap_index(int i, int j)
+template <class T> void CacheT<T>::swap_index(int i, int j)
 {
 	if(i==j) return;
 
@@ -161,27 +251,284 @@ void Cache::swap_index(int i, int j)
 	if(head[j].len) lru_delete(&head[j]);
 	swap(head[i].data,head[j].data);
 	swap(head[i].len,head[j].len);
+	swap(head[i].freq,head[j].freq);
+	swap(head[i].pinned,head[j].pinned);
 	if(head[i].len) lru_insert(&head[i]);
 	if(head[j].len) lru_insert(&head[j]);
 
 	if(i>j) swap(i,j);
-	for(head_t *h = lru_head.next; h!=&lru_head; h=h->next)
-	{
-		if(h->len > i)
+	head_t *lists[2] = { &lru_head, &pin_head };
+	for(int k=0;k<2;k++)
+		for(head_t *h = lists[k]->next; h!=lists[k]; h=h->next)
 		{
-			if(h->len > j)
-				swap(h->data[i],h->data[j]);
-			else
+			if(h->len > i)
 			{
-				// give up
-				lru_delete(h);
-				free(h->data);
-				size += h->len;
-				h->data = 0;
-				h->len = 0;
+				if(h->len > j)
+					swap(h->data[i],h->data[j]);
+				else
+					free_entry(h);	// give up
 			}
 		}
+}
+
+template <class T> void CacheT<T>::set_pinned(int index, bool pinned)
+{
+	head_t *h = &head[index];
+	if(policy != CACHE_SV || h->pinned == pinned) return;
+	if(h->len) lru_delete(h);
+	h->pinned = pinned;
+	if(h->len) lru_insert(h);
+}
+
+typedef CacheT<Qfloat> Cache;
+
+//
+// Half precision kernel cache storage. Columns are stored as IEEE fp16
+// or bfloat16 and expanded to Qfloat when the solver reads them, which
+// doubles the number of cached columns for the same cache_size. fp16
+// keeps 11 significant bits but flushes entries below 6e-8 to zero;
+// bf16 keeps the float range with 8 significant bits.
+//
+typedef unsigned short Qhalf;
+
+static inline Qhalf float_to_fp16(float f)
+{
+#ifdef __F16C__
+	return (Qhalf)_cvtss_sh(f,0);
+#else
+	// round to nearest even, see F. Giesen, "float->half variants"
+	const unsigned int f32infty = 255u << 23;
+	const unsigned int f16max = (127u + 16) << 23;
+	const unsigned int denorm_magic = ((127u - 15) + (23 - 10) + 1) << 23;
+	unsigned int u;
+	memcpy(&u,&f,sizeof(u));
+	unsigned int sign = u & 0x80000000u;
+	Qhalf o;
+	u ^= sign;
+	if(u >= f16max)
+		o = (u > f32infty)? 0x7e00 : 0x7c00;	// NaN or inf
+	else if(u < (113u << 23))
+	{
+		// subnormal fp16, let the float adder do the rounding
+		float fu, fm;
+		memcpy(&fu,&u,sizeof(u));
+		memcpy(&fm,&denorm_magic,sizeof(fm));
+		fu += fm;
+		memcpy(&u,&fu,sizeof(u));
+		o = (Qhalf)(u - denorm_magic);
+	}
+	else
+	{
+		unsigned int mant_odd = (u >> 13) & 1;
+		u += ((unsigned int)(15 - 127) << 23) + 0xfff;
+		u += mant_odd;
+		o = (Qhalf)(u >> 13);
+	}
+	return o | (Qhalf)(sign >> 16);
+#endif
+}
+
+static inline float fp16_to_float(Qhalf h)
+{
+#ifdef __F16C__
+	return _cvtsh_ss(h);
+#else
+	const unsigned int shifted_exp = 0x7c00u << 13;
+	unsigned int o = ((unsigned int)h & 0x7fff) << 13;
+	unsigned int exp = shifted_exp & o;
+	o += (127u - 15) << 23;
+	if(exp == shifted_exp)
+		o += (128u - 16) << 23;	// inf or NaN
+	else if(exp == 0)
+	{
+		// zero or subnormal, renormalize
+		const unsigned int magic = 113u << 23;
+		float fo, fm;
+		o += 1u << 23;
+		memcpy(&fo,&o,sizeof(fo));
+		memcpy(&fm,&magic,sizeof(fm));
+		fo -= fm;
+		memcpy(&o,&fo,sizeof(o));
+	}
+	o |= ((unsigned int)h & 0x8000) << 16;
+	float f;
+	memcpy(&f,&o,sizeof(f));
+	return f;
+#endif
+}
+
+static inline Qhalf float_to_bf16(float f)
+{
+	unsigned int u;
+	memcpy(&u,&f,sizeof(u));
+	if((u & 0x7fffffff) > 0x7f800000)
+		return (Qhalf)((u >> 16) | 0x40);	// keep NaN quiet
+	u += 0x7fff + ((u >> 16) & 1);	// round to nearest even
+	return (Qhalf)(u >> 16);
+}
+
+static inline float bf16_to_float(Qhalf h)
+{
+	unsigned int u = (unsigned int)h << 16;
+	float f;
+	memcpy(&f,&u,sizeof(f));
+	return f;
+}
+
+#ifdef SVM_SIMD
+// the leading multiple of 8 elements of compress_column and expand_column
+// for fp16, returning how many were converted
+SIMD_TARGET static int compress_fp16(const Qfloat *src, Qhalf *dst, int n)
+{
+	int j;
+	for(j=0;j+8<=n;j+=8)
+		_mm_storeu_si128((__m128i *)(dst+j),
+			_mm256_cvtps_ph(_mm256_loadu_ps(src+j),_MM_FROUND_TO_NEAREST_INT));
+	return j;
+}
+
+SIMD_TARGET static int expand_fp16(const Qhalf *src, Qfloat *dst, int n)
+{
+	int j;
+	for(j=0;j+8<=n;j+=8)
+		_mm256_storeu_ps(dst+j,_mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(src+j))));
+	return j;
+}
+#endif
+
+static void compress_column(const Qfloat *src, Qhalf *dst, int n, int cache_type)
+{
+	int j = 0;
+	if(cache_type == CACHE_FP16)
+	{
+#ifdef SVM_SIMD
+		if(simd_ok)
+			j = compress_fp16(src,dst,n);
+#endif
+		for(;j<n;j++)
+			dst[j] = float_to_fp16(src[j]);
+	}
+	else
+		for(;j<n;j++)
+			dst[j] = float_to_bf16(src[j]);
+}
+
+static void expand_column(const Qhalf *src, Qfloat *dst, int n, int cache_type)
+{
+	int j = 0;
+	if(cache_type == CACHE_FP16)
+	{
+#ifdef SVM_SIMD
+		if(simd_ok)
+			j = expand_fp16(src,dst,n);
+#endif
+		for(;j<n;j++)
+			dst[j] = fp16_to_float(src[j]);
+	}
+	else
+		for(;j<n;j++)
+			dst[j] = bf16_to_float(src[j]);
+}
+
+//
+// Reusable buffers for svm_train_nsv. They grow to the largest problem
+// trained with the workspace and are only freed by svm_workspace_destroy.
+// A thread that trains many problems keeps one workspace, so the Solver
+// and Kernel state is not reallocated for every problem. Callers reserve
+// the problem size before handing the workspace to a Solver or Kernel.
+//
+struct svm_workspace
+{
+	int cap;		// number of elements the buffers can hold
+
+	// problem in training order
+	int *perm;		// training order -> index in the problem (of the first
+				// frame of an instance, see collapse_duplicates)
+	int *inst;		// index in the problem -> instance in training order
+	double *weight;		// frames per instance
+	svm_node **x;
+	schar *y;
+	double *minus_ones;
+	double *alpha;
+
+	// Solver state
+	double *s_p;
+	schar *s_y;
+	double *s_alpha;
+	char *s_alpha_status;
+	int *s_active_set;
+	double *s_C;		// per instance upper bounds, see SolverT::weight
+	double *s_G;
+	double *s_G_bar;
+	float *f_G;		// gradient of the float solver, see mixed_precision
+	float *f_G_bar;
+
+	// Kernel and Q matrix state
+	const svm_node **k_x;
+	double *k_x_square;
+	const double **k_xd_rows;
+	double *k_xd;		// dense features, see Kernel
+	size_t k_xd_cap;
+	schar *q_y;
+	double *q_QD;
+
+	int l;			// size of the last problem, 0 if it was not solved
+	svm_solve_info info;	// of the last svm_train_nsv
+};
+
+template <class T> static inline void grow(T*& buf, int n)
+{
+	buf = (T *)realloc((void *)buf,sizeof(T)*n);
+}
+
+static void workspace_reserve(svm_workspace *ws, int l)
+{
+	if(l <= ws->cap) return;
+	grow(ws->perm,l);
+	grow(ws->inst,l);
+	grow(ws->weight,l);
+	grow(ws->x,l);
+	grow(ws->y,l);
+	grow(ws->minus_ones,l);
+	grow(ws->alpha,l);
+	grow(ws->s_p,l);
+	grow(ws->s_y,l);
+	grow(ws->s_alpha,l);
+	grow(ws->s_alpha_status,l);
+	grow(ws->s_active_set,l);
+	grow(ws->s_C,l);
+	grow(ws->s_G,l);
+	grow(ws->s_G_bar,l);
+	grow(ws->f_G,l);
+	grow(ws->f_G_bar,l);
+	grow(ws->k_x,l);
+	grow(ws->k_x_square,l);
+	grow(ws->k_xd_rows,l);
+	grow(ws->q_y,l);
+	grow(ws->q_QD,l);
+	for(int i=ws->cap;i<l;i++)
+		ws->minus_ones[i] = -1;
+	ws->cap = l;
+}
+
+// the dense features are l x d, so they grow separately
+static void workspace_reserve_dense(svm_workspace *ws, size_t n)
+{
+	if(n <= ws->k_xd_cap) return;
+	ws->k_xd = (double *)realloc(ws->k_xd,sizeof(double)*n);
+	ws->k_xd_cap = n;
+}
+
+// copy src into a workspace buffer if there is one, else into a new array
+template <class T> static inline void clone_ws(T*& dst, T* buf, const T* src, int n)
+{
+	if(buf)
+	{
+		dst = buf;
+		memcpy((void *)dst,(const void *)src,sizeof(T)*n);
 	}
+	else
+		clone(dst,src,n);
 }
 
 //
@@ -191,17 +538,129 @@ void Cache::swap_index(int i, int j)
 // the constructor of Kernel prepares to calculate the l*l kernel matrix
 // the member function get_Q is for getting one column from the Q Matrix
 //
+// An entry of a truncated column, see kernel_drop. index is the row in
+// the original problem order; get_Q_sparse also returns pos, which maps
+// it to the row's current position after the solver's swaps.
+struct Qentry
+{
+	int index;
+	Qfloat value;
+};
+
 class QMatrix {
 public:
 	virtual Qfloat *get_Q(int column, int len) const = 0;
 	virtual double *get_QD() const = 0;
 	virtual void swap_index(int i, int j) const = 0;
+	virtual void set_free(int, bool) const {}	// cache hint
+	// the kept entries of a truncated column, false if columns are dense
+	virtual bool get_Q_sparse(int, const Qentry **, int *, const int **) const { return false; }
+	// the cached fp16 column, false unless the solver can convert it itself
+	virtual bool get_Q_fp16(int, int, const Qhalf **) const { return false; }
 	virtual ~QMatrix() {}
 };
 
+//
+// Dot products and squared distances of dense vectors. Residue problems
+// have 3 x (number of atoms) features, so most have one of a few small
+// dimensions. For those the dimension is a template argument and the
+// loop is fully unrolled; other dimensions take the generic loop. Sums
+// are accumulated in index order, as in dot() and sq_dist(), so a
+// dense kernel value is bit for bit the sparse one.
+//
+typedef double (*dense_fn)(const double *a, const double *b, int d);
+
+template <int D> static double dense_dot(const double *a, const double *b, int)
+{
+	double sum = 0;
+	for(int k=0;k<D;k++)
+		sum += a[k]*b[k];
+	return sum;
+}
+
+template <int D> static double dense_sq_dist(const double *a, const double *b, int)
+{
+	double sum = 0;
+	for(int k=0;k<D;k++)
+	{
+		double t = a[k]-b[k];
+		sum += t*t;
+	}
+	return sum;
+}
+
+static double dense_dot_any(const double *a, const double *b, int d)
+{
+	double sum = 0;
+	for(int k=0;k<d;k++)
+		sum += a[k]*b[k];
+	return sum;
+}
+
+static double dense_sq_dist_any(const double *a, const double *b, int d)
+{
+	double sum = 0;
+	for(int k=0;k<d;k++)
+	{
+		double t = a[k]-b[k];
+		sum += t*t;
+	}
+	return sum;
+}
+
+// choose the kernels for dimension d: 3 x 4 to 3 x 24 atoms are unrolled.
+// dot or dist may be NULL if that kernel is not needed.
+static void dense_kernels(int d, dense_fn *dot, dense_fn *dist)
+{
+	switch(d)
+	{
+#define DENSE_CASE(D) case D: \
+		if(dot) *dot = dense_dot<D>; \
+		if(dist) *dist = dense_sq_dist<D>; \
+		return;
+		DENSE_CASE(12) DENSE_CASE(15) DENSE_CASE(18) DENSE_CASE(21)
+		DENSE_CASE(24) DENSE_CASE(27) DENSE_CASE(30) DENSE_CASE(33)
+		DENSE_CASE(36) DENSE_CASE(39) DENSE_CASE(42) DENSE_CASE(45)
+		DENSE_CASE(48) DENSE_CASE(51) DENSE_CASE(54) DENSE_CASE(57)
+		DENSE_CASE(60) DENSE_CASE(63) DENSE_CASE(66) DENSE_CASE(69)
+		DENSE_CASE(72)
+#undef DENSE_CASE
+	}
+	if(dot) *dot = dense_dot_any;
+	if(dist) *dist = dense_sq_dist_any;
+}
+
+// number of features if every x[i] has exactly the indices 1,...,d, else 0
+static int dense_dim(int l, const svm_node * const *x)
+{
+	int d = 0;
+	while(x[0][d].index == d+1)
+		++d;
+	if(x[0][d].index != -1)
+		return 0;
+	for(int i=1;i<l;i++)
+	{
+		const svm_node *px = x[i];
+		for(int k=0;k<d;k++)
+			if(px[k].index != k+1)
+				return 0;
+		if(px[d].index != -1)
+			return 0;
+	}
+	return d;
+}
+
+// copy the rows of x into a row-major l x d array
+static void densify(int l, const svm_node * const *x, int d, double *xd)
+{
+	for(int i=0;i<l;i++)
+		for(int k=0;k<d;k++)
+			xd[(size_t)i*d+k] = x[i][k].value;
+}
+
 class Kernel: public QMatrix {
 public:
-	Kernel(int l, svm_node * const * x, const svm_parameter& param);
+	Kernel(int l, svm_node * const * x, const svm_parameter& param, svm_workspace *ws = NULL);
 	virtual ~Kernel();
 
 	static double k_function(const svm_node *x, const svm_node *y,
@@ -212,6 +671,7 @@ public:
 	{
 		swap(x[i],x[j]);
 		if(x_square) swap(x_square[i],x_square[j]);
+		if(xd) swap(xd[i],xd[j]);
 	}
 protected:
 
@@ -220,6 +680,13 @@ protected:
 private:
 	const svm_node **x;
 	double *x_square;
+	bool own_buffers;	// false if x and x_square belong to a workspace
+
+	// dense copy of x for RBF problems that have every feature, else NULL
+	int dim;
+	const double **xd;	// rows of xd_buf, permuted like x
+	double *xd_buf;
+	dense_fn dense_dot_fn;
 
 	// svm_parameter
 	const int kernel_type;
@@ -240,6 +707,10 @@ private:
 	{
 		return exp(-gamma*(x_square[i]+x_square[j]-2*dot(x[i],x[j])));
 	}
+	double kernel_rbf_dense(int i, int j) const
+	{
+		return exp(-gamma*(x_square[i]+x_square[j]-2*dense_dot_fn(xd[i],xd[j],dim)));
+	}
 	double kernel_sigmoid(int i, int j) const
 	{
 		return tanh(gamma*dot(x[i],x[j])+coef0);
@@ -250,8 +721,8 @@ private:
 	}
 };
 
-Kernel::Kernel(int l, svm_node * const * x_, const svm_parameter& param)
-:kernel_type(param.kernel_type), degree(param.degree),
+Kernel::Kernel(int l, svm_node * const * x_, const svm_parameter& param, svm_workspace *ws)
+:own_buffers(ws == NULL), kernel_type(param.kernel_type), degree(param.degree),
  gamma(param.gamma), coef0(param.coef0)
 {
 	switch(kernel_type)
@@ -273,13 +744,42 @@ Kernel::Kernel(int l, svm_node * const * x_, const svm_parameter& param)
 			break;
 	}
 
-	clone(x,x_,l);
+	if(ws)
+	{
+		x = ws->k_x;
+		memcpy((void *)x,(const void *)x_,sizeof(svm_node *)*l);
+	}
+	else
+		clone(x,x_,l);
+
+	xd = NULL;
+	xd_buf = NULL;
+	dim = kernel_type == RBF? dense_dim(l,x) : 0;
+	if(dim > 0)
+	{
+		dense_kernels(dim,&dense_dot_fn,NULL);
+		if(ws)
+		{
+			workspace_reserve_dense(ws,(size_t)l*dim);
+			xd_buf = ws->k_xd;
+			xd = ws->k_xd_rows;
+		}
+		else
+		{
+			xd_buf = new double[(size_t)l*dim];
+			xd = new const double *[l];
+		}
+		densify(l,x,dim,xd_buf);
+		for(int i=0;i<l;i++)
+			xd[i] = &xd_buf[(size_t)i*dim];
+		kernel_function = &Kernel::kernel_rbf_dense;
+	}
 
 	if(kernel_type == RBF)
 	{
-		x_square = new double[l];
+		x_square = ws? ws->k_x_square : new double[l];
 		for(int i=0;i<l;i++)
-			x_square[i] = dot(x[i],x[i]);
+			x_square[i] = xd? dense_dot_fn(xd[i],xd[i],dim) : dot(x[i],x[i]);
 	}
 	else
 		x_square = 0;
@@ -287,8 +787,11 @@ Kernel::Kernel(int l, svm_node * const * x_, const svm_parameter& param)
 
 Kernel::~Kernel()
 {
+	if(!own_buffers) return;
 	delete[] x;
 	delete[] x_square;
+	delete[] xd;
+	delete[] xd_buf;
 }
 
 double Kernel::dot(const svm_node *px, const svm_node *py)
@@ -313,6 +816,49 @@ double Kernel::dot(const svm_node *px, const svm_node *py)
 	return sum;
 }
 
+// squared euclidean distance between two sparse vectors
+static double sq_dist(const svm_node *x, const svm_node *y)
+{
+	double sum = 0;
+	while(x->index != -1 && y->index !=-1)
+	{
+		if(x->index == y->index)
+		{
+			double d = x->value - y->value;
+			sum += d*d;
+			++x;
+			++y;
+		}
+		else
+		{
+			if(x->index > y->index)
+			{	
+				sum += y->value * y->value;
+				++y;
+			}
+			else
+			{
+				sum += x->value * x->value;
+				++x;
+			}
+		}
+	}
+
+	while(x->index != -1)
+	{
+		sum += x->value * x->value;
+		++x;
+	}
+
+	while(y->index != -1)
+	{
+		sum += y->value * y->value;
+		++y;
+	}
+	return sum;
+}
+
+
 double Kernel::k_function(const svm_node *x, const svm_node *y,
 			  const svm_parameter& param)
 {
@@ -323,46 +869,7 @@ double Kernel::k_function(const svm_node *x, const svm_node *y,
 		case POLY:
 			return powi(param.gamma*dot(x,y)+param.coef0,param.degree);
 		case RBF:
-		{
-			double sum = 0;
-			while(x->index != -1 && y->index !=-1)
-			{
-				if(x->index == y->index)
-				{
-					double d = x->value - y->value;
-					sum += d*d;
-					++x;
-					++y;
-				}
-				else
-				{
-					if(x->index > y->index)
-					{	
-						sum += y->value * y->value;
-						++y;
-					}
-					else
-					{
-						sum += x->value * x->value;
-						++x;
-					}
-				}
-			}
-
-			while(x->index != -1)
-			{
-				sum += x->value * x->value;
-				++x;
-			}
-
-			while(y->index != -1)
-			{
-				sum += y->value * y->value;
-				++y;
-			}
-			
-			return exp(-param.gamma*sum);
-		}
+			return exp(-param.gamma*sq_dist(x,y));
 		case SIGMOID:
 			return tanh(param.gamma*dot(x,y)+param.coef0);
 		case PRECOMPUTED:  //x: test (validation), y: SV
@@ -390,10 +897,16 @@ double Kernel::k_function(const svm_node *x, const svm_node *y,
 //
 // solution will be put in \alpha, objective value will be put in obj
 //
-class Solver {
+// R is the type of the gradient. Solver uses double. SolverT<float>
+// halves the memory traffic of the gradient update and doubles the SIMD
+// width of the I_up scan, at the cost of a gradient that drifts by float
+// rounding; svm_train_nsv only uses it to find a starting point for a
+// double solve (see mixed_precision).
+//
+template <class R> class SolverT {
 public:
-	Solver() {};
-	virtual ~Solver() {};
+	SolverT(svm_workspace *ws_ = NULL): ws(ws_), keep_order(false), iter_limit(0), time_limit(0), weight(NULL) {};
+	virtual ~SolverT() {};
 
 	struct SolutionInfo {
 		double obj;
@@ -401,6 +914,9 @@ public:
 		double upper_bound_p;
 		double upper_bound_n;
 		double r;	// for Solver_NU
+		int iter;	// SMO iterations
+		double gap;	// KKT gap at the end, below eps unless stopped
+		bool stopped;	// by iter_limit or time_limit
 	};
 
 	void Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
@@ -409,7 +925,7 @@ public:
 protected:
 	int active_size;
 	schar *y;
-	double *G;		// gradient of objective function
+	R *G;		// gradient of objective function
 	enum { LOWER_BOUND, UPPER_BOUND, FREE };
 	char *alpha_status;	// LOWER_BOUND, UPPER_BOUND, FREE
 	double *alpha;
@@ -419,12 +935,22 @@ protected:
 	double Cp,Cn;
 	double *p;
 	int *active_set;
-	double *G_bar;		// gradient, if we treat free variables as 0
+	R *G_bar;		// gradient, if we treat free variables as 0
 	int l;
 	bool unshrink;	// XXX
+	svm_workspace *ws;	// if not NULL, the state arrays are taken from it
+public:
+	bool keep_order;	// undo the shrinking permutation of Q after Solve
+	int iter_limit;		// stop after this many iterations, 0 = libsvm's limit
+	double time_limit;	// stop at this svm_wall_time, 0 = none
+	const double *weight;	// if not NULL, alpha_i <= weight[i]*C, for instances
+				// that stand for weight[i] identical frames
+protected:
+	double *C;		// per instance bounds if weight is set, else NULL
 
 	double get_C(int i)
 	{
+		if(C) return C[i];
 		return (y[i] > 0)? Cp : Cn;
 	}
 	void update_alpha_status(int i)
@@ -434,12 +960,14 @@ protected:
 		else if(alpha[i] <= 0)
 			alpha_status[i] = LOWER_BOUND;
 		else alpha_status[i] = FREE;
+		Q->set_free(i, alpha_status[i] == FREE);
 	}
 	bool is_upper_bound(int i) { return alpha_status[i] == UPPER_BOUND; }
 	bool is_lower_bound(int i) { return alpha_status[i] == LOWER_BOUND; }
 	bool is_free(int i) { return alpha_status[i] == FREE; }
 	void swap_index(int i, int j);
 	void reconstruct_gradient();
+	double kkt_gap();
 	virtual int select_working_set(int &i, int &j);
 	virtual double calculate_rho();
 	virtual void do_shrinking();
@@ -447,33 +975,181 @@ private:
 	bool be_shrunk(int i, double Gmax1, double Gmax2);
 };
 
-void Solver::swap_index(int i, int j)
+typedef SolverT<double> Solver;
+
+static inline void ws_gradient(svm_workspace *ws, double *&G, double *&G_bar)
 {
-	Q->swap_index(i,j);
-	swap(y[i],y[j]);
-	swap(G[i],G[j]);
-	swap(alpha_status[i],alpha_status[j]);
-	swap(alpha[i],alpha[j]);
-	swap(p[i],p[j]);
-	swap(active_set[i],active_set[j]);
-	swap(G_bar[i],G_bar[j]);
+	G = ws->s_G;
+	G_bar = ws->s_G_bar;
 }
 
-void Solver::reconstruct_gradient()
+static inline void ws_gradient(svm_workspace *ws, float *&G, float *&G_bar)
 {
-	// reconstruct inactive elements of G from G_bar and free variables
+	G = ws->f_G;
+	G_bar = ws->f_G_bar;
+}
 
-	if(active_size == l) return;
+#ifdef SVM_SIMD
+// the leading elements of update_gradient, returning how many were updated
+SIMD_TARGET static int update_gradient_simd(double *G, const Qfloat *Q_i, const Qfloat *Q_j,
+					    double delta_alpha_i, double delta_alpha_j, int n)
+{
+	__m256d dai = _mm256_set1_pd(delta_alpha_i);
+	__m256d daj = _mm256_set1_pd(delta_alpha_j);
+	int k;
+	for(k=0;k+4<=n;k+=4)
+	{
+		__m256d qi = _mm256_mul_pd(_mm256_cvtps_pd(_mm_loadu_ps(Q_i+k)),dai);
+		__m256d qj = _mm256_mul_pd(_mm256_cvtps_pd(_mm_loadu_ps(Q_j+k)),daj);
+		_mm256_storeu_pd(G+k,_mm256_add_pd(_mm256_loadu_pd(G+k),_mm256_add_pd(qi,qj)));
+	}
+	return k;
+}
 
-	int i,j;
-	int nr_free = 0;
+SIMD_TARGET static int update_gradient_simd(float *G, const Qfloat *Q_i, const Qfloat *Q_j,
+					    float dai, float daj, int n)
+{
+	__m256 vdai = _mm256_set1_ps(dai);
+	__m256 vdaj = _mm256_set1_ps(daj);
+	int k;
+	for(k=0;k+8<=n;k+=8)
+	{
+		__m256 qi = _mm256_mul_ps(_mm256_loadu_ps(Q_i+k),vdai);
+		__m256 qj = _mm256_mul_ps(_mm256_loadu_ps(Q_j+k),vdaj);
+		_mm256_storeu_ps(G+k,_mm256_add_ps(_mm256_loadu_ps(G+k),_mm256_add_ps(qi,qj)));
+	}
+	return k;
+}
 
-	for(j=active_size;j<l;j++)
-		G[j] = G_bar[j] + p[j];
+SIMD_TARGET static int update_gradient_simd(double *G, const Qhalf *H_i, const Qhalf *H_j,
+					    double delta_alpha_i, double delta_alpha_j, int n)
+{
+	__m256d dai = _mm256_set1_pd(delta_alpha_i);
+	__m256d daj = _mm256_set1_pd(delta_alpha_j);
+	int k;
+	for(k=0;k+4<=n;k+=4)
+	{
+		__m128 hi = _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)(H_i+k)));
+		__m128 hj = _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)(H_j+k)));
+		__m256d qi = _mm256_mul_pd(_mm256_cvtps_pd(hi),dai);
+		__m256d qj = _mm256_mul_pd(_mm256_cvtps_pd(hj),daj);
+		_mm256_storeu_pd(G+k,_mm256_add_pd(_mm256_loadu_pd(G+k),_mm256_add_pd(qi,qj)));
+	}
+	return k;
+}
 
-	for(j=0;j<active_size;j++)
-		if(is_free(j))
-			nr_free++;
+SIMD_TARGET static int update_gradient_simd(float *G, const Qhalf *H_i, const Qhalf *H_j,
+					    float dai, float daj, int n)
+{
+	__m256 vdai = _mm256_set1_ps(dai);
+	__m256 vdaj = _mm256_set1_ps(daj);
+	int k;
+	for(k=0;k+8<=n;k+=8)
+	{
+		__m256 qi = _mm256_mul_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(H_i+k))),vdai);
+		__m256 qj = _mm256_mul_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(H_j+k))),vdaj);
+		_mm256_storeu_ps(G+k,_mm256_add_ps(_mm256_loadu_ps(G+k),_mm256_add_ps(qi,qj)));
+	}
+	return k;
+}
+#endif
+
+// G[k] += Q_i[k]*delta_alpha_i + Q_j[k]*delta_alpha_j for k in [0,n)
+static inline void update_gradient(double *G, const Qfloat *Q_i, const Qfloat *Q_j,
+				   double delta_alpha_i, double delta_alpha_j, int n)
+{
+	int k = 0;
+#ifdef SVM_SIMD
+	if(simd_ok)
+		k = update_gradient_simd(G,Q_i,Q_j,delta_alpha_i,delta_alpha_j,n);
+#endif
+	for(;k<n;k++)
+		G[k] += Q_i[k]*delta_alpha_i + Q_j[k]*delta_alpha_j;
+}
+
+static inline void update_gradient(float *G, const Qfloat *Q_i, const Qfloat *Q_j,
+				   double delta_alpha_i, double delta_alpha_j, int n)
+{
+	float dai = (float)delta_alpha_i;
+	float daj = (float)delta_alpha_j;
+	int k = 0;
+#ifdef SVM_SIMD
+	if(simd_ok)
+		k = update_gradient_simd(G,Q_i,Q_j,dai,daj,n);
+#endif
+	for(;k<n;k++)
+		G[k] += Q_i[k]*dai + Q_j[k]*daj;
+}
+
+// update_gradient on fp16 columns, converted as they are read so that a
+// column is not expanded into a buffer first
+static inline void update_gradient(double *G, const Qhalf *H_i, const Qhalf *H_j,
+				   double delta_alpha_i, double delta_alpha_j, int n)
+{
+	int k = 0;
+#ifdef SVM_SIMD
+	if(simd_ok)
+		k = update_gradient_simd(G,H_i,H_j,delta_alpha_i,delta_alpha_j,n);
+#endif
+	for(;k<n;k++)
+		G[k] += fp16_to_float(H_i[k])*delta_alpha_i + fp16_to_float(H_j[k])*delta_alpha_j;
+}
+
+static inline void update_gradient(float *G, const Qhalf *H_i, const Qhalf *H_j,
+				   double delta_alpha_i, double delta_alpha_j, int n)
+{
+	float dai = (float)delta_alpha_i;
+	float daj = (float)delta_alpha_j;
+	int k = 0;
+#ifdef SVM_SIMD
+	if(simd_ok)
+		k = update_gradient_simd(G,H_i,H_j,dai,daj,n);
+#endif
+	for(;k<n;k++)
+		G[k] += fp16_to_float(H_i[k])*dai + fp16_to_float(H_j[k])*daj;
+}
+
+// G[pos[e.index]] += e.value*delta_alpha for the entries e of a
+// truncated column whose rows are in [0,n)
+template <class R> static inline void update_gradient_sparse(R *G, const Qentry *col, int len,
+							     const int *pos, double delta_alpha, int n)
+{
+	for(int k=0;k<len;k++)
+	{
+		int p = pos[col[k].index];
+		if(p < n)
+			G[p] += (R)(col[k].value*delta_alpha);
+	}
+}
+
+template <class R> void SolverT<R>::swap_index(int i, int j)
+{
+	Q->swap_index(i,j);
+	swap(y[i],y[j]);
+	swap(G[i],G[j]);
+	swap(alpha_status[i],alpha_status[j]);
+	swap(alpha[i],alpha[j]);
+	swap(p[i],p[j]);
+	swap(active_set[i],active_set[j]);
+	swap(G_bar[i],G_bar[j]);
+	if(C) swap(C[i],C[j]);
+}
+
+template <class R> void SolverT<R>::reconstruct_gradient()
+{
+	// reconstruct inactive elements of G from G_bar and free variables
+
+	if(active_size == l) return;
+
+	int i,j;
+	int nr_free = 0;
+
+	for(j=active_size;j<l;j++)
+		G[j] = (R)(G_bar[j] + p[j]);
+
+	for(j=0;j<active_size;j++)
+		if(is_free(j))
+			nr_free++;
 
 	if(2*nr_free < active_size)
 		info("\nWARNING: using -h 0 may be faster\n");
@@ -485,7 +1161,7 @@ void Solver::reconstruct_gradient()
 			const Qfloat *Q_i = Q->get_Q(i,active_size);
 			for(j=0;j<active_size;j++)
 				if(is_free(j))
-					G[i] += alpha[j] * Q_i[j];
+					G[i] = (R)(G[i] + alpha[j] * Q_i[j]);
 		}
 	}
 	else
@@ -496,36 +1172,43 @@ void Solver::reconstruct_gradient()
 				const Qfloat *Q_i = Q->get_Q(i,l);
 				double alpha_i = alpha[i];
 				for(j=active_size;j<l;j++)
-					G[j] += alpha_i * Q_i[j];
+					G[j] = (R)(G[j] + alpha_i * Q_i[j]);
 			}
 	}
 }
 
-void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
+template <class R> void SolverT<R>::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 		   double *alpha_, double Cp, double Cn, double eps,
 		   SolutionInfo* si, int shrinking)
 {
 	this->l = l;
 	this->Q = &Q;
 	QD=Q.get_QD();
-	clone(p, p_,l);
-	clone(y, y_,l);
-	clone(alpha,alpha_,l);
+	clone_ws(p, ws? ws->s_p : NULL, p_,l);
+	clone_ws(y, ws? ws->s_y : NULL, y_,l);
+	clone_ws(alpha, ws? ws->s_alpha : NULL, alpha_,l);
 	this->Cp = Cp;
 	this->Cn = Cn;
 	this->eps = eps;
 	unshrink = false;
+	C = NULL;
+	if(weight)
+	{
+		C = ws? ws->s_C : new double[l];
+		for(int i=0;i<l;i++)
+			C[i] = weight[i] * (y[i] > 0? Cp : Cn);
+	}
 
 	// initialize alpha_status
 	{
-		alpha_status = new char[l];
+		alpha_status = ws? ws->s_alpha_status : new char[l];
 		for(int i=0;i<l;i++)
 			update_alpha_status(i);
 	}
 
 	// initialize active set (for shrinking)
 	{
-		active_set = new int[l];
+		active_set = ws? ws->s_active_set : new int[l];
 		for(int i=0;i<l;i++)
 			active_set[i] = i;
 		active_size = l;
@@ -533,12 +1216,17 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 
 	// initialize gradient
 	{
-		G = new double[l];
-		G_bar = new double[l];
+		if(ws)
+			ws_gradient(ws,G,G_bar);
+		else
+		{
+			G = new R[l];
+			G_bar = new R[l];
+		}
 		int i;
 		for(i=0;i<l;i++)
 		{
-			G[i] = p[i];
+			G[i] = (R)p[i];
 			G_bar[i] = 0;
 		}
 		for(i=0;i<l;i++)
@@ -548,10 +1236,10 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 				double alpha_i = alpha[i];
 				int j;
 				for(j=0;j<l;j++)
-					G[j] += alpha_i*Q_i[j];
+					G[j] = (R)(G[j] + alpha_i*Q_i[j]);
 				if(is_upper_bound(i))
 					for(j=0;j<l;j++)
-						G_bar[j] += get_C(i) * Q_i[j];
+						G_bar[j] = (R)(G_bar[j] + get_C(i) * Q_i[j]);
 			}
 	}
 
@@ -560,8 +1248,12 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 	int iter = 0;
 	int max_iter = max(10000000, l>INT_MAX/100 ? INT_MAX : 100*l);
 	int counter = min(l,1000)+1;
+	bool stopped = time_limit > 0 && svm_wall_time() >= time_limit;
+	bool converged = false;	// select_working_set's criterion holds
+	if(iter_limit > 0 && iter_limit < max_iter)
+		max_iter = iter_limit;
 	
-	while(iter < max_iter)
+	while(iter < max_iter && !stopped)
 	{
 		// show progress and do shrinking
 
@@ -570,6 +1262,11 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 			counter = min(l,1000);
 			if(shrinking) do_shrinking();
 			info(".");
+			if(time_limit > 0 && svm_wall_time() >= time_limit)
+			{
+				stopped = true;
+				break;
+			}
 		}
 
 		int i,j;
@@ -581,7 +1278,10 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 			active_size = l;
 			info("*");
 			if(select_working_set(i,j)!=0)
+			{
+				converged = true;
 				break;
+			}
 			else
 				counter = 1;	// do shrinking next iteration
 		}
@@ -590,8 +1290,18 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 
 		// update alpha[i] and alpha[j], handle bounds carefully
 		
-		const Qfloat *Q_i = Q.get_Q(i,active_size);
-		const Qfloat *Q_j = Q.get_Q(j,active_size);
+		// fp16 columns, when the kernel hands them out, are converted
+		// in the gradient update instead of in get_Q
+		const Qfloat *Q_i = NULL, *Q_j = NULL;
+		const Qhalf *H_i = NULL, *H_j = NULL;
+		bool half = Q.get_Q_fp16(i,active_size,&H_i) &&
+			    Q.get_Q_fp16(j,active_size,&H_j);
+		if(!half)
+		{
+			Q_i = Q.get_Q(i,active_size);
+			Q_j = Q.get_Q(j,active_size);
+		}
+		double Q_ij = half? (double)fp16_to_float(H_i[j]) : (double)Q_i[j];
 
 		double C_i = get_C(i);
 		double C_j = get_C(j);
@@ -601,7 +1311,7 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 
 		if(y[i]!=y[j])
 		{
-			double quad_coef = QD[i]+QD[j]+2*Q_i[j];
+			double quad_coef = QD[i]+QD[j]+2*Q_ij;
 			if (quad_coef <= 0)
 				quad_coef = TAU;
 			double delta = (-G[i]-G[j])/quad_coef;
@@ -644,7 +1354,7 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 		}
 		else
 		{
-			double quad_coef = QD[i]+QD[j]-2*Q_i[j];
+			double quad_coef = QD[i]+QD[j]-2*Q_ij;
 			if (quad_coef <= 0)
 				quad_coef = TAU;
 			double delta = (G[i]-G[j])/quad_coef;
@@ -691,10 +1401,21 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 		double delta_alpha_i = alpha[i] - old_alpha_i;
 		double delta_alpha_j = alpha[j] - old_alpha_j;
 		
-		for(int k=0;k<active_size;k++)
+		// truncated columns only touch the rows of their kept entries
+		const Qentry *col_i, *col_j;
+		int n_i, n_j;
+		const int *pos;
+		bool sparse = Q.get_Q_sparse(i,&col_i,&n_i,&pos) &&
+			      Q.get_Q_sparse(j,&col_j,&n_j,&pos);
+		if(sparse)
 		{
-			G[k] += Q_i[k]*delta_alpha_i + Q_j[k]*delta_alpha_j;
+			update_gradient_sparse(G,col_i,n_i,pos,delta_alpha_i,active_size);
+			update_gradient_sparse(G,col_j,n_j,pos,delta_alpha_j,active_size);
 		}
+		else if(half)
+			update_gradient(G,H_i,H_j,delta_alpha_i,delta_alpha_j,active_size);
+		else
+			update_gradient(G,Q_i,Q_j,delta_alpha_i,delta_alpha_j,active_size);
 
 		// update alpha_status and G_bar
 
@@ -706,29 +1427,45 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 			int k;
 			if(ui != is_upper_bound(i))
 			{
-				Q_i = Q.get_Q(i,l);
-				if(ui)
-					for(k=0;k<l;k++)
-						G_bar[k] -= C_i * Q_i[k];
+				if(sparse)
+				{
+					Q.get_Q_sparse(i,&col_i,&n_i,&pos);
+					update_gradient_sparse(G_bar,col_i,n_i,pos,ui? -C_i : C_i,l);
+				}
 				else
-					for(k=0;k<l;k++)
-						G_bar[k] += C_i * Q_i[k];
+				{
+					Q_i = Q.get_Q(i,l);
+					if(ui)
+						for(k=0;k<l;k++)
+							G_bar[k] = (R)(G_bar[k] - C_i * Q_i[k]);
+					else
+						for(k=0;k<l;k++)
+							G_bar[k] = (R)(G_bar[k] + C_i * Q_i[k]);
+				}
 			}
 
 			if(uj != is_upper_bound(j))
 			{
-				Q_j = Q.get_Q(j,l);
-				if(uj)
-					for(k=0;k<l;k++)
-						G_bar[k] -= C_j * Q_j[k];
+				if(sparse)
+				{
+					Q.get_Q_sparse(j,&col_j,&n_j,&pos);
+					update_gradient_sparse(G_bar,col_j,n_j,pos,uj? -C_j : C_j,l);
+				}
 				else
-					for(k=0;k<l;k++)
-						G_bar[k] += C_j * Q_j[k];
+				{
+					Q_j = Q.get_Q(j,l);
+					if(uj)
+						for(k=0;k<l;k++)
+							G_bar[k] = (R)(G_bar[k] - C_j * Q_j[k]);
+					else
+						for(k=0;k<l;k++)
+							G_bar[k] = (R)(G_bar[k] + C_j * Q_j[k]);
+				}
 			}
 		}
 	}
 
-	if(iter >= max_iter)
+	if(!converged)
 	{
 		if(active_size < l)
 		{
@@ -737,12 +1474,22 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 			active_size = l;
 			info("*");
 		}
-		fprintf(stderr,"\nWARNING: reaching max number of iterations\n");
+		// the last iteration allowed may have met the criterion
+		int i,j;
+		converged = select_working_set(i,j)!=0;
+		stopped = !converged &&
+			  (stopped || (iter_limit > 0 && iter >= iter_limit));
+		if(stopped)
+			info("\nstopped by the iteration or time limit\n");
+		else if(!converged)
+			fprintf(stderr,"\nWARNING: reaching max number of iterations\n");
 	}
 
 	// calculate rho
 
 	si->rho = calculate_rho();
+	si->gap = kkt_gap();
+	si->stopped = stopped;
 
 	// calculate objective value
 	{
@@ -761,18 +1508,20 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 	}
 
 	// juggle everything back
-	/*{
+	if(keep_order)
+	{
 		for(int i=0;i<l;i++)
 			while(active_set[i] != i)
 				swap_index(i,active_set[i]);
-				// or Q.swap_index(i,active_set[i]);
-	}*/
+	}
 
 	si->upper_bound_p = Cp;
 	si->upper_bound_n = Cn;
+	si->iter = iter;
 
 	info("\noptimization finished, #iter = %d\n",iter);
 
+	if(ws) return;
 	delete[] p;
 	delete[] y;
 	delete[] alpha;
@@ -780,10 +1529,217 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 	delete[] active_set;
 	delete[] G;
 	delete[] G_bar;
+	delete[] C;
+}
+
+#ifdef SVM_SIMD
+//
+// AVX2 versions of the scans over the active set, 4 elements per step.
+// Both keep the last index among equal candidates, like the scalar
+// loops, and return how many leading elements they covered so that the
+// scalar loops can finish the tail.
+//
+
+// y[t] as doubles, and a mask of the lanes whose alpha_status differs
+// from `bad', which is UPPER_BOUND (1) for y=+1 lanes if up, else LOWER_BOUND (0)
+SIMD_TARGET static inline __m256d load_y(const schar *y, __m128i *y32)
+{
+	int b;
+	memcpy(&b,y,sizeof(int));
+	*y32 = _mm_cvtepi8_epi32(_mm_cvtsi32_si128(b));
+	return _mm256_cvtepi32_pd(*y32);
+}
+
+SIMD_TARGET static inline __m256d status_mask(const char *status, __m128i y32, bool up)
+{
+	int b;
+	memcpy(&b,status,sizeof(int));
+	__m128i s32 = _mm_cvtepi8_epi32(_mm_cvtsi32_si128(b));
+	// (1+y)/2 is 1 for y=+1 and 0 for y=-1, (1-y)/2 the other way round
+	__m128i one = _mm_set1_epi32(1);
+	__m128i bad = up? _mm_srai_epi32(_mm_add_epi32(one,y32),1)
+			: _mm_srai_epi32(_mm_sub_epi32(one,y32),1);
+	__m128i eq = _mm_cmpeq_epi32(s32,bad);
+	return _mm256_castsi256_pd(_mm256_xor_si256(_mm256_cvtepi32_epi64(eq),_mm256_set1_epi64x(-1)));
+}
+
+// argmax of -y_t*G_t over t in I_up
+SIMD_TARGET static int max_violating_up(int n, const schar *y, const char *status, const double *G,
+			    double &Gmax, int &Gmax_idx)
+{
+	__m256d vmax = _mm256_set1_pd(-INF);
+	__m256d vidx = _mm256_set1_pd(-1);
+	__m256d idx = _mm256_setr_pd(0,1,2,3);
+	const __m256d four = _mm256_set1_pd(4);
+	const __m256d zero = _mm256_setzero_pd();
+	int t;
+	for(t=0;t+4<=n;t+=4)
+	{
+		__m128i y32;
+		__m256d yd = load_y(y+t,&y32);
+		__m256d v = _mm256_mul_pd(_mm256_sub_pd(zero,yd),_mm256_loadu_pd(G+t));
+		__m256d m = _mm256_and_pd(status_mask(status+t,y32,true),
+					  _mm256_cmp_pd(v,vmax,_CMP_GE_OQ));
+		vmax = _mm256_blendv_pd(vmax,v,m);
+		vidx = _mm256_blendv_pd(vidx,idx,m);
+		idx = _mm256_add_pd(idx,four);
+	}
+	double val[4], ind[4];
+	_mm256_storeu_pd(val,vmax);
+	_mm256_storeu_pd(ind,vidx);
+	for(int k=0;k<4;k++)
+		if(val[k] > Gmax || (val[k] == Gmax && (int)ind[k] > Gmax_idx))
+		{
+			Gmax = val[k];
+			Gmax_idx = (int)ind[k];
+		}
+	return t;
+}
+
+SIMD_TARGET static inline __m256d load_G(const double *G)
+{
+	return _mm256_loadu_pd(G);
+}
+
+SIMD_TARGET static inline __m256d load_G(const float *G)
+{
+	return _mm256_cvtps_pd(_mm_loadu_ps(G));
+}
+
+// argmin of the second order objective decrease over j in I_low, and
+// the max of y_j*G_j over I_low. A float gradient is widened, so that
+// quad_coef and obj_diff are computed in double as in the scalar tail,
+// and both rank candidates the same way.
+template <class R> SIMD_TARGET static int min_obj_diff_low(int n, const schar *y, const char *status, const R *G,
+			    const double *QD, const Qfloat *Q_i, double QD_i, schar y_i,
+			    double Gmax, double &Gmax2, double &obj_diff_min, int &Gmin_idx)
+{
+	__m256d vGmax = _mm256_set1_pd(Gmax);
+	__m256d vGmax2 = _mm256_set1_pd(-INF);
+	__m256d vmin = _mm256_set1_pd(INF);
+	__m256d vidx = _mm256_set1_pd(-1);
+	__m256d idx = _mm256_setr_pd(0,1,2,3);
+	const __m256d four = _mm256_set1_pd(4);
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d ninf = _mm256_set1_pd(-INF);
+	const __m256d tau = _mm256_set1_pd(TAU);
+	const __m256d vQD_i = _mm256_set1_pd(QD_i);
+	const __m256d two_y_i = _mm256_set1_pd(2.0*y_i);
+	int t;
+	for(t=0;t+4<=n;t+=4)
+	{
+		__m128i y32;
+		__m256d yd = load_y(y+t,&y32);
+		__m256d elig = status_mask(status+t,y32,false);
+		__m256d v = _mm256_mul_pd(yd,load_G(G+t));
+		vGmax2 = _mm256_max_pd(vGmax2,_mm256_blendv_pd(ninf,v,elig));
+
+		__m256d grad_diff = _mm256_add_pd(vGmax,v);
+		__m256d q = _mm256_mul_pd(_mm256_mul_pd(two_y_i,yd),
+					  _mm256_cvtps_pd(_mm_loadu_ps(Q_i+t)));
+		__m256d quad_coef = _mm256_sub_pd(_mm256_add_pd(vQD_i,_mm256_loadu_pd(QD+t)),q);
+		quad_coef = _mm256_blendv_pd(tau,quad_coef,_mm256_cmp_pd(quad_coef,zero,_CMP_GT_OQ));
+		__m256d obj_diff = _mm256_div_pd(_mm256_sub_pd(zero,_mm256_mul_pd(grad_diff,grad_diff)),quad_coef);
+
+		__m256d m = _mm256_and_pd(_mm256_and_pd(elig,_mm256_cmp_pd(grad_diff,zero,_CMP_GT_OQ)),
+					  _mm256_cmp_pd(obj_diff,vmin,_CMP_LE_OQ));
+		vmin = _mm256_blendv_pd(vmin,obj_diff,m);
+		vidx = _mm256_blendv_pd(vidx,idx,m);
+		idx = _mm256_add_pd(idx,four);
+	}
+	double val[4], ind[4], g2[4];
+	_mm256_storeu_pd(val,vmin);
+	_mm256_storeu_pd(ind,vidx);
+	_mm256_storeu_pd(g2,vGmax2);
+	for(int k=0;k<4;k++)
+	{
+		if(g2[k] > Gmax2)
+			Gmax2 = g2[k];
+		if(val[k] < obj_diff_min || (val[k] == obj_diff_min && (int)ind[k] > Gmin_idx))
+		{
+			obj_diff_min = val[k];
+			Gmin_idx = (int)ind[k];
+		}
+	}
+	return t;
+}
+
+// The I_up scan over a float gradient, 8 elements per step; -y*G is exact
+// in float. Indices are held in float lanes, which is exact for any l
+// below 2^24.
+SIMD_TARGET static inline __m256 load_y(const schar *y, __m256i *y32)
+{
+	long long b;
+	memcpy(&b,y,sizeof(long long));
+	*y32 = _mm256_cvtepi8_epi32(_mm_cvtsi64_si128(b));
+	return _mm256_cvtepi32_ps(*y32);
+}
+
+SIMD_TARGET static inline __m256 status_mask(const char *status, __m256i y32, bool up)
+{
+	long long b;
+	memcpy(&b,status,sizeof(long long));
+	__m256i s32 = _mm256_cvtepi8_epi32(_mm_cvtsi64_si128(b));
+	__m256i one = _mm256_set1_epi32(1);
+	__m256i bad = up? _mm256_srai_epi32(_mm256_add_epi32(one,y32),1)
+			: _mm256_srai_epi32(_mm256_sub_epi32(one,y32),1);
+	__m256i eq = _mm256_cmpeq_epi32(s32,bad);
+	return _mm256_castsi256_ps(_mm256_xor_si256(eq,_mm256_set1_epi32(-1)));
+}
+
+SIMD_TARGET static int max_violating_up(int n, const schar *y, const char *status, const float *G,
+			    double &Gmax, int &Gmax_idx)
+{
+	__m256 vmax = _mm256_set1_ps(-INF);
+	__m256 vidx = _mm256_set1_ps(-1);
+	__m256 idx = _mm256_setr_ps(0,1,2,3,4,5,6,7);
+	const __m256 eight = _mm256_set1_ps(8);
+	const __m256 zero = _mm256_setzero_ps();
+	int t;
+	for(t=0;t+8<=n;t+=8)
+	{
+		__m256i y32;
+		__m256 yf = load_y(y+t,&y32);
+		__m256 v = _mm256_mul_ps(_mm256_sub_ps(zero,yf),_mm256_loadu_ps(G+t));
+		__m256 m = _mm256_and_ps(status_mask(status+t,y32,true),
+					 _mm256_cmp_ps(v,vmax,_CMP_GE_OQ));
+		vmax = _mm256_blendv_ps(vmax,v,m);
+		vidx = _mm256_blendv_ps(vidx,idx,m);
+		idx = _mm256_add_ps(idx,eight);
+	}
+	float val[8], ind[8];
+	_mm256_storeu_ps(val,vmax);
+	_mm256_storeu_ps(ind,vidx);
+	for(int k=0;k<8;k++)
+		if(val[k] > Gmax || (val[k] == Gmax && (int)ind[k] > Gmax_idx))
+		{
+			Gmax = val[k];
+			Gmax_idx = (int)ind[k];
+		}
+	return t;
 }
+#endif
 
 // return 1 if already optimal, return 0 otherwise
-int Solver::select_working_set(int &out_i, int &out_j)
+// max over I_up of -y*G minus min over I_low, which select_working_set
+// brings below eps; 0 if either set is empty
+template <class R> double SolverT<R>::kkt_gap()
+{
+	double Gmax = -INF, Gmin = INF;
+	for(int i=0;i<active_size;i++)
+	{
+		double v = -y[i]*G[i];
+		if(y[i] == +1? !is_upper_bound(i) : !is_lower_bound(i))
+			Gmax = max(Gmax,v);
+		if(y[i] == +1? !is_lower_bound(i) : !is_upper_bound(i))
+			Gmin = min(Gmin,v);
+	}
+	if(Gmax == -INF || Gmin == INF)
+		return 0;
+	return max(Gmax-Gmin,0.0);
+}
+
+template <class R> int SolverT<R>::select_working_set(int &out_i, int &out_j)
 {
 	// return i,j such that
 	// i: maximizes -y_i * grad(f)_i, i in I_up(\alpha)
@@ -797,7 +1753,12 @@ int Solver::select_working_set(int &out_i, int &out_j)
 	int Gmin_idx = -1;
 	double obj_diff_min = INF;
 
-	for(int t=0;t<active_size;t++)
+	int t = 0;
+#ifdef SVM_SIMD
+	if(simd_ok)
+		t = max_violating_up(active_size,y,alpha_status,G,Gmax,Gmax_idx);
+#endif
+	for(;t<active_size;t++)
 		if(y[t]==+1)	
 		{
 			if(!is_upper_bound(t))
@@ -822,7 +1783,13 @@ int Solver::select_working_set(int &out_i, int &out_j)
 	if(i != -1) // NULL Q_i not accessed: Gmax=-INF if i=-1
 		Q_i = Q->get_Q(i,active_size);
 
-	for(int j=0;j<active_size;j++)
+	int j = 0;
+#ifdef SVM_SIMD
+	if(simd_ok && i != -1)
+		j = min_obj_diff_low(active_size,y,alpha_status,G,QD,Q_i,QD[i],y[i],
+				     Gmax,Gmax2,obj_diff_min,Gmin_idx);
+#endif
+	for(;j<active_size;j++)
 	{
 		if(y[j]==+1)
 		{
@@ -882,7 +1849,7 @@ int Solver::select_working_set(int &out_i, int &out_j)
 	return 0;
 }
 
-bool Solver::be_shrunk(int i, double Gmax1, double Gmax2)
+template <class R> bool SolverT<R>::be_shrunk(int i, double Gmax1, double Gmax2)
 {
 	if(is_upper_bound(i))
 	{
@@ -902,7 +1869,7 @@ bool Solver::be_shrunk(int i, double Gmax1, double Gmax2)
 		return(false);
 }
 
-void Solver::do_shrinking()
+template <class R> void SolverT<R>::do_shrinking()
 {
 	int i;
 	double Gmax1 = -INF;		// max { -y_i * grad(f)_i | i in I_up(\alpha) }
@@ -963,7 +1930,7 @@ void Solver::do_shrinking()
 		}
 }
 
-double Solver::calculate_rho()
+template <class R> double SolverT<R>::calculate_rho()
 {
 	double r;
 	int nr_free = 0;
@@ -1266,12 +2233,46 @@ double Solver_NU::calculate_rho()
 class SVC_Q: public Kernel
 { 
 public:
-	SVC_Q(const svm_problem& prob, const svm_parameter& param, const schar *y_)
-	:Kernel(prob.l, prob.x, param)
+	SVC_Q(const svm_problem& prob, const svm_parameter& param, const schar *y_, svm_workspace *ws = NULL)
+	:Kernel(prob.l, prob.x, param, ws), own_buffers(ws == NULL)
 	{
-		clone(y,y_,prob.l);
-		cache = new Cache(prob.l,(long int)(param.cache_size*(1<<20)));
-		QD = new double[prob.l];
+		clone_ws(y, ws? ws->q_y : NULL, y_,prob.l);
+		cache_type = param.cache_type;
+		kernel_drop = param.kernel_drop;
+		l = prob.l;
+		cache = NULL;
+		hcache = NULL;
+		scache = NULL;
+		if(kernel_drop > 0)
+		{
+			scache = new CacheT<Qentry>(prob.l,(long int)(param.cache_size*(1<<20)),param.cache_policy);
+			scratch = new Qentry[prob.l];
+			pos = new int[prob.l];
+			orig = new int[prob.l];
+			for(int i=0;i<prob.l;i++)
+				pos[i] = orig[i] = i;
+			dropped_mass = 0;
+			kept = computed = 0;
+			for(int k=0;k<2;k++)
+			{
+				written[k] = new int[prob.l];
+				nwritten[k] = 0;
+			}
+		}
+		else if(cache_type == CACHE_FLOAT)
+			cache = new Cache(prob.l,(long int)(param.cache_size*(1<<20)),param.cache_policy);
+		else
+			hcache = new CacheT<Qhalf>(prob.l,(long int)(param.cache_size*(1<<20)),param.cache_policy);
+		if(!cache)
+		{
+			buffer[0] = new Qfloat[prob.l];
+			buffer[1] = new Qfloat[prob.l];
+			next_buffer = 0;
+			if(scache)
+				for(int i=0;i<prob.l;i++)
+					buffer[0][i] = buffer[1][i] = 0;
+		}
+		QD = ws? ws->q_QD : new double[prob.l];
 		for(int i=0;i<prob.l;i++)
 			QD[i] = (this->*kernel_function)(i,i);
 	}
@@ -1280,6 +2281,10 @@ public:
 	{
 		Qfloat *data;
 		int start, j;
+		if(scache)
+			return get_Q_trunc(i,len);
+		if(hcache)
+			return get_Q_half(i,len);
 		if((start = cache->get_data(i,&data,len)) < len)
 		{
 //#pragma omp parallel for private(j) schedule(guided)
@@ -1289,6 +2294,113 @@ public:
 		return data;
 	}
 
+	// the solver holds at most two columns at a time, as with SVR_Q
+	Qfloat *get_Q_half(int i, int len) const
+	{
+		Qfloat *buf = buffer[next_buffer];
+		next_buffer = 1 - next_buffer;
+		expand_column(fill_half(i,len,buf),buf,len,cache_type);
+		return buf;
+	}
+
+	bool get_Q_fp16(int i, int len, const Qhalf **column) const
+	{
+#ifdef SVM_SIMD
+		if(hcache && cache_type == CACHE_FP16 && simd_ok)
+		{
+			*column = fill_half(i,len,buffer[0]);
+			return true;
+		}
+#endif
+		return false;
+	}
+
+	// the first len entries of cached column i, computed through buf
+	Qhalf *fill_half(int i, int len, Qfloat *buf) const
+	{
+		Qhalf *data;
+		int start, j;
+		if((start = hcache->get_data(i,&data,len)) < len)
+		{
+			for(j=start;j<len;j++)
+				buf[j] = (Qfloat)(y[i]*y[j]*(this->*kernel_function)(i,j));
+			compress_column(buf+start,data+start,len-start,cache_type);
+		}
+		return data;
+	}
+
+	// With kernel_drop, a column is computed whole and only the entries
+	// with |Q| >= kernel_drop (and the diagonal) are cached, keyed by
+	// original indices so that swaps do not touch the cache. Far apart
+	// frames have RBF values that underflow to nothing at large gamma,
+	// so columns of well separated residues keep a few entries.
+	const Qentry *get_column(int i, int *n) const
+	{
+		Qentry *data;
+		int oi = orig[i];
+		int len = scache->cached_len(oi);
+		if(len == 0)
+		{
+			double dropped = 0;
+			for(int j=0;j<l;j++)
+			{
+				Qfloat q = (Qfloat)(y[i]*y[j]*(this->*kernel_function)(i,j));
+				if(fabs(q) >= kernel_drop || j == i)
+				{
+					scratch[len].index = orig[j];
+					scratch[len].value = q;
+					++len;
+				}
+				else
+					dropped += fabs(q);
+			}
+			dropped_mass = max(dropped_mass,dropped);
+			kept += len;
+			computed += l;
+			scache->get_data(oi,&data,len);
+			memcpy(data,scratch,sizeof(Qentry)*len);
+		}
+		else
+			scache->get_data(oi,&data,len);
+		*n = len;
+		return data;
+	}
+
+	// The solver holds at most two columns at a time, as with SVR_Q.
+	// The buffers stay zero outside the rows last written, so expanding
+	// a column costs its kept entries rather than len.
+	Qfloat *get_Q_trunc(int i, int len) const
+	{
+		int n, k;
+		const Qentry *col = get_column(i,&n);
+		Qfloat *buf = buffer[next_buffer];
+		int *rows = written[next_buffer];
+		int &nrows = nwritten[next_buffer];
+		next_buffer = 1 - next_buffer;
+		for(k=0;k<nrows;k++)
+			buf[rows[k]] = 0;
+		nrows = 0;
+		for(k=0;k<n;k++)
+		{
+			int p = pos[col[k].index];
+			if(p < len)
+			{
+				buf[p] = col[k].value;
+				rows[nrows++] = p;
+			}
+		}
+		return buf;
+	}
+
+	bool get_Q_sparse(int i, const Qentry **col, int *n, const int **pos_) const
+	{
+		if(!scache)
+			return false;
+		*col = get_column(i,n);
+		*pos_ = pos;
+		return true;
+	}
+
 	double *get_QD() const
 	{
 		return QD;
@@ -1296,21 +2408,97 @@ public:
 
 	void swap_index(int i, int j) const
 	{
-		cache->swap_index(i,j);
+		if(scache)
+		{
+			swap(pos[orig[i]],pos[orig[j]]);
+			swap(orig[i],orig[j]);
+		}
+		else if(hcache)
+			hcache->swap_index(i,j);
+		else
+			cache->swap_index(i,j);
 		Kernel::swap_index(i,j);
 		swap(y[i],y[j]);
 		swap(QD[i],QD[j]);
 	}
 
+	void set_free(int i, bool is_free) const
+	{
+		if(scache)
+			scache->set_pinned(orig[i],is_free);
+		else if(hcache)
+			hcache->set_pinned(i,is_free);
+		else
+			cache->set_pinned(i,is_free);
+	}
+
+	void get_cache_stats(svm_solve_info *info) const
+	{
+		info->dropped_mass = 0;
+		info->kept_fraction = 1;
+		if(scache)
+		{
+			info->cache_hits = scache->hits;
+			info->cache_misses = scache->misses;
+			info->cache_evictions = scache->evictions;
+			info->dropped_mass = dropped_mass;
+			if(computed > 0)
+				info->kept_fraction = (double)kept/(double)computed;
+		}
+		else if(hcache)
+		{
+			info->cache_hits = hcache->hits;
+			info->cache_misses = hcache->misses;
+			info->cache_evictions = hcache->evictions;
+		}
+		else
+		{
+			info->cache_hits = cache->hits;
+			info->cache_misses = cache->misses;
+			info->cache_evictions = cache->evictions;
+		}
+	}
+
 	~SVC_Q()
 	{
-		delete[] y;
 		delete cache;
+		delete hcache;
+		if(scache)
+		{
+			delete scache;
+			delete[] scratch;
+			delete[] pos;
+			delete[] orig;
+			delete[] written[0];
+			delete[] written[1];
+		}
+		if(!cache)
+		{
+			delete[] buffer[0];
+			delete[] buffer[1];
+		}
+		if(!own_buffers) return;
+		delete[] y;
 		delete[] QD;
 	}
 private:
+	bool own_buffers;
 	schar *y;
+	int cache_type;
 	Cache *cache;
+	CacheT<Qhalf> *hcache;	// used instead of cache for half precision storage
+	CacheT<Qentry> *scache;	// used instead of both for truncated columns
+	int l;
+	double kernel_drop;
+	Qentry *scratch;
+	int *pos;		// current position of each original row
+	int *orig;		// original row at each position
+	mutable double dropped_mass;
+	mutable long kept, computed;
+	int *written[2];	// rows of buffer[k] that hold a nonzero
+	mutable int nwritten[2];
+	mutable int next_buffer;
+	Qfloat *buffer[2];
 	double *QD;
 };
 
@@ -1436,31 +2624,166 @@ private:
 };
 
 //
-// construct and solve various formulations
+// RBF Q matrix for training one C-SVC problem at several gamma and C values.
+// Squared distances are optionally precomputed once (as floats) and
+// exponentiated per gamma; the kernel cache only depends on gamma, so it
+// is kept across C values. The solver permutes the matrix while shrinking,
+// restore() puts it back in the original order before the next solve.
 //
-static void solve_c_svc(
-	const svm_problem *prob, const svm_parameter* param,
-	double *alpha, Solver::SolutionInfo* si, double Cp, double Cn)
+class SweepQ: public QMatrix
 {
-	int l = prob->l;
-	double *minus_ones = new double[l];
-	schar *y = new schar[l];
-
-	int i;
+public:
+	SweepQ(const svm_problem& prob, const svm_parameter& param, const schar *y_, bool keep_d2,
+	       const float *d2_ = NULL)
+	:l(prob.l), cache_size((long int)(param.cache_size*(1<<20))),
+	 cache_policy(param.cache_policy), gamma(param.gamma)
+	{
+		clone(x,prob.x,l);
+		clone(y,y_,l);
+		xd = NULL;
+		dim = dense_dim(l,x);
+		if(dim > 0)
+		{
+			dense_kernels(dim,NULL,&dense_dist_fn);
+			xd = new double[(size_t)l*dim];
+			densify(l,x,dim,xd);
+		}
+		idx = new int[l];
+		QD = new double[l];
+		for(int i=0;i<l;i++)
+		{
+			idx[i] = i;
+			QD[i] = 1;	// exp(-gamma*0)
+		}
+		d2 = d2_;
+		own_d2 = NULL;
+		if(keep_d2 && !d2)
+		{
+			own_d2 = new float[(size_t)l*l];
+			for(int i=0;i<l;i++)
+			{
+				own_d2[(size_t)i*l+i] = 0;
+				for(int j=i+1;j<l;j++)
+					own_d2[(size_t)i*l+j] = own_d2[(size_t)j*l+i] = (float)dist(i,j);
+			}
+			d2 = own_d2;
+		}
+		cache = new Cache(l,cache_size,cache_policy);
+	}
 
-	for(i=0;i<l;i++)
+	void set_gamma(double gamma_)
 	{
-		alpha[i] = 0;
-		minus_ones[i] = -1;
-		if(prob->y[i] > 0) y[i] = +1; else y[i] = -1;
+		if(gamma_ == gamma) return;
+		gamma = gamma_;
+		delete cache;
+		cache = new Cache(l,cache_size,cache_policy);
 	}
 
-	Solver s;
-	s.Solve(l, SVC_Q(*prob,*param,y), minus_ones, y,
-		alpha, Cp, Cn, param->eps, si, param->shrinking);
+	Qfloat *get_Q(int i, int len) const
+	{
+		Qfloat *data;
+		int start, j;
+		if((start = cache->get_data(i,&data,len)) < len)
+		{
+			int oi = idx[i];
+			if(d2)
+			{
+				const float *d2_i = &d2[(size_t)oi*l];
+				for(j=start;j<len;j++)
+					data[j] = (Qfloat)(y[i]*y[j]*exp(-gamma*d2_i[idx[j]]));
+			}
+			else
+				for(j=start;j<len;j++)
+					data[j] = (Qfloat)(y[i]*y[j]*exp(-gamma*dist(oi,idx[j])));
+		}
+		return data;
+	}
 
-	double sum_alpha=0;
-	for(i=0;i<l;i++)
+	double *get_QD() const
+	{
+		return QD;
+	}
+
+	void swap_index(int i, int j) const
+	{
+		cache->swap_index(i,j);
+		swap(y[i],y[j]);
+		swap(idx[i],idx[j]);
+	}
+
+	void set_free(int i, bool is_free) const
+	{
+		cache->set_pinned(i,is_free);
+	}
+
+	void restore() const
+	{
+		for(int i=0;i<l;i++)
+			while(idx[i] != i)
+				swap_index(i,idx[i]);
+	}
+
+	~SweepQ()
+	{
+		delete[] x;
+		delete[] y;
+		delete[] idx;
+		delete[] QD;
+		delete[] own_d2;
+		delete[] xd;
+		delete cache;
+	}
+private:
+	int l;
+	long int cache_size;
+	int cache_policy;
+	double gamma;
+	const svm_node **x;
+	schar *y;
+	int *idx;	// original index of each position
+	double *QD;
+	const float *d2;	// squared distances in original order, or NULL
+	float *own_d2;		// d2 if computed here rather than passed in
+	int dim;
+	double *xd;	// dense features in original order, or NULL
+	dense_fn dense_dist_fn;
+	Cache *cache;
+
+	// squared distance between original indices a and b
+	double dist(int a, int b) const
+	{
+		if(xd)
+			return dense_dist_fn(&xd[(size_t)a*dim],&xd[(size_t)b*dim],dim);
+		return sq_dist(x[a],x[b]);
+	}
+};
+
+//
+// construct and solve various formulations
+//
+static void solve_c_svc(
+	const svm_problem *prob, const svm_parameter* param,
+	double *alpha, Solver::SolutionInfo* si, double Cp, double Cn)
+{
+	int l = prob->l;
+	double *minus_ones = new double[l];
+	schar *y = new schar[l];
+
+	int i;
+
+	for(i=0;i<l;i++)
+	{
+		alpha[i] = 0;
+		minus_ones[i] = -1;
+		if(prob->y[i] > 0) y[i] = +1; else y[i] = -1;
+	}
+
+	Solver s;
+	s.Solve(l, SVC_Q(*prob,*param,y), minus_ones, y,
+		alpha, Cp, Cn, param->eps, si, param->shrinking);
+
+	double sum_alpha=0;
+	for(i=0;i<l;i++)
 		sum_alpha += alpha[i];
 
 	if (Cp==Cn)
@@ -2333,130 +3656,1915 @@ svm_model *svm_train(const svm_problem *prob, const svm_parameter *param)
 		free(nz_count);
 		free(nz_start);
 	}
-	return model;
+	return model;
+}
+
+// Stratified cross validation
+void svm_cross_validation(const svm_problem *prob, const svm_parameter *param, int nr_fold, double *target)
+{
+	int i;
+	int *fold_start;
+	int l = prob->l;
+	int *perm = Malloc(int,l);
+	int nr_class;
+	if (nr_fold > l)
+	{
+		nr_fold = l;
+		fprintf(stderr,"WARNING: # folds > # data. Will use # folds = # data instead (i.e., leave-one-out cross validation)\n");
+	}
+	fold_start = Malloc(int,nr_fold+1);
+	// stratified cv may not give leave-one-out rate
+	// Each class to l folds -> some folds may have zero elements
+	if((param->svm_type == C_SVC ||
+	    param->svm_type == NU_SVC) && nr_fold < l)
+	{
+		int *start = NULL;
+		int *label = NULL;
+		int *count = NULL;
+		svm_group_classes(prob,&nr_class,&label,&start,&count,perm);
+
+		// random shuffle and then data grouped by fold using the array perm
+		int *fold_count = Malloc(int,nr_fold);
+		int c;
+		int *index = Malloc(int,l);
+		for(i=0;i<l;i++)
+			index[i]=perm[i];
+		for (c=0; c<nr_class; c++) 
+			for(i=0;i<count[c];i++)
+			{
+				int j = i+rand()%(count[c]-i);
+				swap(index[start[c]+j],index[start[c]+i]);
+			}
+		for(i=0;i<nr_fold;i++)
+		{
+			fold_count[i] = 0;
+			for (c=0; c<nr_class;c++)
+				fold_count[i]+=(i+1)*count[c]/nr_fold-i*count[c]/nr_fold;
+		}
+		fold_start[0]=0;
+		for (i=1;i<=nr_fold;i++)
+			fold_start[i] = fold_start[i-1]+fold_count[i-1];
+		for (c=0; c<nr_class;c++)
+			for(i=0;i<nr_fold;i++)
+			{
+				int begin = start[c]+i*count[c]/nr_fold;
+				int end = start[c]+(i+1)*count[c]/nr_fold;
+				for(int j=begin;j<end;j++)
+				{
+					perm[fold_start[i]] = index[j];
+					fold_start[i]++;
+				}
+			}
+		fold_start[0]=0;
+		for (i=1;i<=nr_fold;i++)
+			fold_start[i] = fold_start[i-1]+fold_count[i-1];
+		free(start);
+		free(label);
+		free(count);
+		free(index);
+		free(fold_count);
+	}
+	else
+	{
+		for(i=0;i<l;i++) perm[i]=i;
+		for(i=0;i<l;i++)
+		{
+			int j = i+rand()%(l-i);
+			swap(perm[i],perm[j]);
+		}
+		for(i=0;i<=nr_fold;i++)
+			fold_start[i]=i*l/nr_fold;
+	}
+
+	for(i=0;i<nr_fold;i++)
+	{
+		int begin = fold_start[i];
+		int end = fold_start[i+1];
+		int j,k;
+		struct svm_problem subprob;
+
+		subprob.l = l-(end-begin);
+		subprob.x = Malloc(struct svm_node*,subprob.l);
+		subprob.y = Malloc(double,subprob.l);
+			
+		k=0;
+		for(j=0;j<begin;j++)
+		{
+			subprob.x[k] = prob->x[perm[j]];
+			subprob.y[k] = prob->y[perm[j]];
+			++k;
+		}
+		for(j=end;j<l;j++)
+		{
+			subprob.x[k] = prob->x[perm[j]];
+			subprob.y[k] = prob->y[perm[j]];
+			++k;
+		}
+		struct svm_model *submodel = svm_train(&subprob,param);
+		if(param->probability && 
+		   (param->svm_type == C_SVC || param->svm_type == NU_SVC))
+		{
+			double *prob_estimates=Malloc(double,svm_get_nr_class(submodel));
+			for(j=begin;j<end;j++)
+				target[perm[j]] = svm_predict_probability(submodel,prob->x[perm[j]],prob_estimates);
+			free(prob_estimates);
+		}
+		else
+			for(j=begin;j<end;j++)
+				target[perm[j]] = svm_predict(submodel,prob->x[perm[j]]);
+		svm_free_and_destroy_model(&submodel);
+		free(subprob.x);
+		free(subprob.y);
+	}		
+	free(fold_start);
+	free(perm);
+}
+
+
+svm_workspace *svm_workspace_create()
+{
+	svm_workspace *ws = Malloc(svm_workspace,1);
+	memset(ws,0,sizeof(svm_workspace));	// null buffers, cap = 0
+	return ws;
+}
+
+void svm_workspace_destroy(svm_workspace *ws)
+{
+	if(ws == NULL) return;
+	free(ws->perm);
+	free(ws->inst);
+	free(ws->weight);
+	free(ws->x);
+	free(ws->y);
+	free(ws->minus_ones);
+	free(ws->alpha);
+	free(ws->s_p);
+	free(ws->s_y);
+	free(ws->s_alpha);
+	free(ws->s_alpha_status);
+	free(ws->s_active_set);
+	free(ws->s_C);
+	free(ws->s_G);
+	free(ws->s_G_bar);
+	free(ws->f_G);
+	free(ws->f_G_bar);
+	free((void *)ws->k_x);
+	free(ws->k_x_square);
+	free(ws->k_xd_rows);
+	free(ws->k_xd);
+	free(ws->q_y);
+	free(ws->q_QD);
+	free(ws);
+}
+
+//
+// Divide and conquer warm start, after DC-SVM (Hsieh, Si and Dhillon,
+// ICML 2014). The problem is split into dc_clusters groups by kernel
+// k-means and each group is solved on its own. Every group's alpha
+// meets the bounds and y'alpha = 0, so together they are a feasible
+// start for the whole problem, and most of their SVs are SVs of the
+// whole problem. The full solve then only has to fix the interactions
+// between groups, and stops at the usual eps. Groups are solved in
+// parallel if OpenMP is enabled and the caller is not in a parallel
+// region already.
+//
+#define DC_SAMPLE 64	// k-means sample points per cluster
+#define DC_ITER 20	// k-means iterations on the sample
+
+// Kernel k-means on an evenly spaced sample, then every point goes to
+// its nearest cluster in feature space. Clusters start as the same
+// stretch of frames of both classes, so they begin with both classes.
+// y is +1 for the first np points and -1 for the rest.
+static void dc_cluster(const svm_problem *prob, const svm_parameter *param,
+		       int np, int k, int *cluster)
+{
+	int l = prob->l;
+	int m = min(l,DC_SAMPLE*k);
+	int s, t, c;
+	int *sample = Malloc(int,m);
+	int *assign = Malloc(int,m);
+	int *next = Malloc(int,m);
+	int *count = Malloc(int,k);
+	double *self = Malloc(double,k);
+	double *K = Malloc(double,(size_t)m*m);
+
+	for(s=0;s<m;s++)
+	{
+		int i = sample[s] = (int)((long)s*l/m);
+		assign[s] = i < np? (int)((long)i*k/np) : (int)((long)(i-np)*k/(l-np));
+	}
+	for(s=0;s<m;s++)
+		for(t=0;t<=s;t++)
+			K[(size_t)s*m+t] = K[(size_t)t*m+s] =
+				Kernel::k_function(prob->x[sample[s]],prob->x[sample[t]],*param);
+
+	// ||phi(x) - mean of c||^2 = K(x,x) - 2 sum_t K(x,t)/|c| + self[c]
+	for(int iter=0;iter<DC_ITER;iter++)
+	{
+		for(c=0;c<k;c++)
+		{
+			count[c] = 0;
+			self[c] = 0;
+		}
+		for(s=0;s<m;s++)
+			++count[assign[s]];
+		for(s=0;s<m;s++)
+			for(t=0;t<m;t++)
+				if(assign[s] == assign[t])
+					self[assign[s]] += K[(size_t)s*m+t];
+		for(c=0;c<k;c++)
+			if(count[c] > 0)
+				self[c] /= (double)count[c]*count[c];
+
+		int changed = 0;
+		double *sum = Malloc(double,k);
+		for(s=0;s<m;s++)
+		{
+			for(c=0;c<k;c++)
+				sum[c] = 0;
+			for(t=0;t<m;t++)
+				sum[assign[t]] += K[(size_t)s*m+t];
+			int best = assign[s];
+			double best_dist = INF;
+			for(c=0;c<k;c++)
+				if(count[c] > 0)
+				{
+					double dist = self[c] - 2*sum[c]/count[c];
+					if(dist < best_dist)
+					{
+						best_dist = dist;
+						best = c;
+					}
+				}
+			next[s] = best;
+			changed += best != assign[s];
+		}
+		free(sum);
+		swap(assign,next);
+		if(!changed)
+			break;
+	}
+	for(c=0;c<k;c++)
+		count[c] = 0;
+	for(s=0;s<m;s++)
+		++count[assign[s]];
+
+#pragma omp parallel private(c)
+	{
+		double *sum = Malloc(double,k);
+#pragma omp for schedule(static)
+		for(int i=0;i<l;i++)
+		{
+			for(c=0;c<k;c++)
+				sum[c] = 0;
+			for(int t=0;t<m;t++)
+				sum[assign[t]] += Kernel::k_function(prob->x[i],prob->x[sample[t]],*param);
+			int best = 0;
+			double best_dist = INF;
+			for(c=0;c<k;c++)
+				if(count[c] > 0)
+				{
+					double dist = self[c] - 2*sum[c]/count[c];
+					if(dist < best_dist)
+					{
+						best_dist = dist;
+						best = c;
+					}
+				}
+			cluster[i] = best;
+		}
+		free(sum);
+	}
+
+	free(sample);
+	free(assign);
+	free(next);
+	free(count);
+	free(self);
+	free(K);
+}
+
+// Solve the clusters of prob on their own and store their alphas in
+// alpha, which must be 0 on entry. Clusters with one class keep alpha 0,
+// which is their solution.
+static void dc_warm_start(const svm_problem *prob, const svm_parameter *param,
+			  const schar *y, double Cp, double Cn, double *alpha,
+			  long *iter)
+{
+	int l = prob->l;
+	int k = param->dc_clusters;
+	int i, c;
+	int np = 0;
+	for(i=0;i<l;i++)
+		np += y[i] > 0;
+
+	int *cluster = Malloc(int,l);
+	dc_cluster(prob,param,np,k,cluster);
+
+	// members of cluster c are index[start[c],start[c+1]), in problem order
+	int *start = Malloc(int,k+1);
+	int *index = Malloc(int,l);
+	for(c=0;c<=k;c++)
+		start[c] = 0;
+	for(i=0;i<l;i++)
+		++start[cluster[i]+1];
+	for(c=0;c<k;c++)
+		start[c+1] += start[c];
+	for(i=0;i<l;i++)
+		index[start[cluster[i]]++] = i;
+	for(c=k;c>0;c--)
+		start[c] = start[c-1];
+	start[0] = 0;
+
+	long sub_iter = 0;
+#pragma omp parallel for schedule(dynamic) private(i) reduction(+:sub_iter)
+	for(c=0;c<k;c++)
+	{
+		int n = start[c+1] - start[c];
+		const int *member = index + start[c];
+		int npos = 0;
+		for(i=0;i<n;i++)
+			npos += y[member[i]] > 0;
+		if(npos == 0 || npos == n)
+			continue;
+
+		svm_problem sub_prob;
+		sub_prob.l = n;
+		sub_prob.x = Malloc(svm_node *,n);
+		sub_prob.y = NULL;
+		schar *sub_y = Malloc(schar,n);
+		double *sub_alpha = Malloc(double,n);
+		double *minus_ones = Malloc(double,n);
+		for(i=0;i<n;i++)
+		{
+			sub_prob.x[i] = prob->x[member[i]];
+			sub_y[i] = y[member[i]];
+			sub_alpha[i] = 0;
+			minus_ones[i] = -1;
+		}
+
+		Solver::SolutionInfo si;
+		Solver s;
+		SVC_Q Q(sub_prob,*param,sub_y);
+		s.Solve(n, Q, minus_ones, sub_y,
+			sub_alpha, Cp, Cn, param->eps, &si, param->shrinking);
+		sub_iter += si.iter;
+		for(i=0;i<n;i++)
+			alpha[member[i]] = sub_alpha[i];
+
+		free(sub_prob.x);
+		free(sub_y);
+		free(sub_alpha);
+		free(minus_ones);
+	}
+
+	*iter += sub_iter;
+	free(cluster);
+	free(start);
+	free(index);
+}
+
+//
+// Support vector screening. Frames deep inside their own ensemble are
+// far from every frame of the other one and end with alpha = 0. Only
+// the sv_screen nearest frames of the other class of some frame are
+// trained at first. The gradient of the whole problem is then computed
+// from that solution, and the frames left out that violate the KKT
+// conditions are added and training repeats, until the whole problem
+// meets the solver's stopping rule. The full solve then starts from
+// that solution, so the result is always one of the full solve; from a
+// screened solution it usually stops after a few iterations.
+//
+#define SCREEN_ROUNDS 10	// then the full solve takes over
+#define SCREEN_EPS 0.1		// candidates are solved to SCREEN_EPS*eps
+#define SCREEN_SAMPLE 256	// neighbour search sample per class
+
+// Marks in cand the frames that have a frame of the other class among
+// their k nearest neighbours. Neighbours are searched in an evenly
+// spaced sample of SCREEN_SAMPLE frames of each class, so this costs
+// l*2*SCREEN_SAMPLE distances rather than l*l. The first np frames
+// are of one class.
+static void screen_candidates(const svm_problem *prob, int np, int k, char *cand)
+{
+	int l = prob->l;
+	int d = dense_dim(l,prob->x);
+	double *xd = NULL;
+	dense_fn dist = NULL;
+	if(d > 0)
+	{
+		dense_kernels(d,NULL,&dist);
+		xd = Malloc(double,(size_t)l*d);
+		densify(l,prob->x,d,xd);
+	}
+
+	int mp = min(np,SCREEN_SAMPLE), mn = min(l-np,SCREEN_SAMPLE);
+	int m = mp + mn;
+	int *sample = Malloc(int,m);
+	for(int s=0;s<mp;s++)
+		sample[s] = (int)((long)s*np/mp);
+	for(int s=0;s<mn;s++)
+		sample[mp+s] = np + (int)((long)s*(l-np)/mn);
+	k = min(k,m-1);
+
+#pragma omp parallel
+	{
+		double *best = Malloc(double,k);
+		int *nb = Malloc(int,k);
+#pragma omp for schedule(static)
+		for(int i=0;i<l;i++)
+		{
+			int n = 0;
+			for(int s=0;s<m;s++)
+			{
+				int j = sample[s];
+				if(j == i)
+					continue;
+				double dij = xd? dist(&xd[(size_t)i*d],&xd[(size_t)j*d],d) :
+						 sq_dist(prob->x[i],prob->x[j]);
+				if(n == k && dij >= best[k-1])
+					continue;
+				// insert into the sorted list of the k nearest
+				int p = n < k? n++ : k-1;
+				for(;p>0 && best[p-1]>dij;p--)
+				{
+					best[p] = best[p-1];
+					nb[p] = nb[p-1];
+				}
+				best[p] = dij;
+				nb[p] = j;
+			}
+			for(int p=0;p<n;p++)
+				if((nb[p] < np) != (i < np))
+					cand[i] = 1;
+		}
+		free(best);
+		free(nb);
+	}
+
+	// a class without candidates starts from its sample
+	int cp = 0, cn = 0;
+	for(int i=0;i<l;i++)
+		if(cand[i])
+			++(i < np? cp : cn);
+	for(int s=0;s<m;s++)
+		if(sample[s] < np? cp == 0 : cn == 0)
+			cand[sample[s]] = 1;
+
+	free(sample);
+	free(xd);
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y? -1 : x > y;
+}
+
+// Solve prob by screening, see above. Q is the Q matrix of the whole
+// problem, used to check the KKT conditions. Returns false if the
+// candidates grew to the whole problem or SCREEN_ROUNDS did not
+// suffice. Either way alpha is a feasible start for the full solve.
+// The candidates get their own cache, sized for them alone.
+static bool screen_solve(const svm_problem *prob, const svm_parameter *param,
+			 const schar *y, const QMatrix& Q, double Cp, double Cn,
+			 double *alpha, long *iter)
+{
+	int l = prob->l;
+	int i, j;
+	char *cand = Malloc(char,l);
+	int *index = Malloc(int,l);
+	double *G = Malloc(double,l);
+	bool solved = false;
+
+	int np = 0;
+	for(i=0;i<l;i++)
+	{
+		cand[i] = 0;
+		np += y[i] > 0;
+	}
+	screen_candidates(prob,np,param->sv_screen,cand);
+
+	svm_problem sub_prob;
+	sub_prob.x = Malloc(svm_node *,l);
+	sub_prob.y = NULL;
+	schar *sub_y = Malloc(schar,l);
+	double *sub_alpha = Malloc(double,l);
+	double *minus_ones = Malloc(double,l);
+	for(i=0;i<l;i++)
+		minus_ones[i] = -1;
+
+	for(int round=0;round<SCREEN_ROUNDS;round++)
+	{
+		// frames left out have alpha = 0, so the candidates' alphas
+		// are a feasible start for them
+		int n = 0;
+		for(i=0;i<l;i++)
+			if(cand[i])
+				index[n++] = i;
+		info("screening round %d: %d of %d frames\n",round+1,n,l);
+		if(n > l/2)	// overlapping ensembles, screening would not pay
+			break;
+		for(i=0;i<n;i++)
+		{
+			sub_prob.x[i] = prob->x[index[i]];
+			sub_y[i] = y[index[i]];
+			sub_alpha[i] = alpha[index[i]];
+		}
+		sub_prob.l = n;
+		{
+			Solver::SolutionInfo si;
+			Solver s;
+			svm_parameter sub_param = *param;
+			sub_param.cache_size = min(param->cache_size,
+						   (double)n*n*sizeof(Qfloat)/(1<<20) + 1);
+			SVC_Q sub_Q(sub_prob,sub_param,sub_y);
+			s.Solve(n, sub_Q, minus_ones, sub_y,
+				sub_alpha, Cp, Cn, SCREEN_EPS*param->eps, &si, param->shrinking);
+			*iter += si.iter;
+		}
+		for(i=0;i<n;i++)
+			alpha[index[i]] = sub_alpha[i];
+
+		// gradient of the whole problem
+		for(i=0;i<l;i++)
+			G[i] = -1;
+		for(j=0;j<l;j++)
+			if(alpha[j] > 0)
+			{
+				const Qfloat *Q_j = Q.get_Q(j,l);
+				for(i=0;i<l;i++)
+					G[i] += alpha[j]*Q_j[i];
+			}
+
+		// the solver stops once max over I_up of -y*G is within eps
+		// of min over I_low, see select_working_set
+		double up = -INF, low = INF, cand_up = -INF, cand_low = INF;
+		for(i=0;i<l;i++)
+		{
+			double C_i = y[i] > 0? Cp : Cn;
+			double v = -y[i]*G[i];
+			if((y[i] > 0 && alpha[i] < C_i) || (y[i] < 0 && alpha[i] > 0))
+			{
+				up = max(up,v);
+				if(cand[i])
+					cand_up = max(cand_up,v);
+			}
+			if((y[i] > 0 && alpha[i] > 0) || (y[i] < 0 && alpha[i] < C_i))
+			{
+				low = min(low,v);
+				if(cand[i])
+					cand_low = min(cand_low,v);
+			}
+		}
+		if(up - low < param->eps)
+		{
+			solved = true;
+			break;
+		}
+
+		// add the frames left out that break the candidates' bounds,
+		// at most as many as there are candidates and worst first;
+		// frames far from every SV often only violate them until the
+		// SVs near them have been added
+		int nviol = 0;
+		for(i=0;i<l;i++)
+		{
+			if(cand[i])
+				continue;
+			double v = -y[i]*G[i];
+			double viol = y[i] > 0? v - cand_low : cand_up - v;	// alpha = 0
+			if(viol >= param->eps)
+			{
+				G[nviol] = -viol;	// G is recomputed next round
+				index[nviol++] = i;
+			}
+		}
+		if(nviol == 0)
+			break;
+		if(nviol > n)
+		{
+			double *worst = Malloc(double,nviol);
+			memcpy(worst,G,sizeof(double)*nviol);
+			qsort(worst,nviol,sizeof(double),compare_double);
+			double cut = worst[n-1];
+			free(worst);
+			for(i=0;i<nviol;i++)
+				if(G[i] <= cut && n > 0)
+				{
+					cand[index[i]] = 1;
+					--n;
+				}
+		}
+		else
+			for(i=0;i<nviol;i++)
+				cand[index[i]] = 1;
+	}
+
+	free(cand);
+	free(index);
+	free(G);
+	free(sub_prob.x);
+	free(sub_y);
+	free(sub_alpha);
+	free(minus_ones);
+	return solved;
+}
+
+// Find the two labels of prob for svm_train_nsv. The first label seen
+// is the positive class, unless labels are -1/+1. Returns 2, or 0 if
+// there is one class and -1 if there are more than two.
+static int nsv_labels(const svm_problem *prob, int *label_p, int *label_n)
+{
+	*label_p = *label_n = (int)prob->y[0];
+	for(int i=1;i<prob->l;i++)
+	{
+		int this_label = (int)prob->y[i];
+		if(this_label == *label_p || this_label == *label_n)
+			continue;
+		if(*label_n != *label_p)
+		{
+			fprintf(stderr,"ERROR: svm_train_nsv only supports two classes\n");
+			return -1;
+		}
+		*label_n = this_label;
+	}
+	if(*label_n == *label_p)
+	{
+		info("WARNING: training data in only one class. See README for details.\n");
+		return 0;
+	}
+	if(*label_p == -1 && *label_n == 1)
+		swap(*label_p,*label_n);
+	return 2;
+}
+
+// weighted C, as in svm_train
+static void nsv_weights(const svm_parameter *param, int label_p, int label_n,
+			double *Cp, double *Cn)
+{
+	*Cp = *Cn = param->C;
+	for(int i=0;i<param->nr_weight;i++)
+	{
+		if(param->weight_label[i] == label_p)
+			*Cp *= param->weight[i];
+		else if(param->weight_label[i] == label_n)
+			*Cn *= param->weight[i];
+	}
+}
+
+// FNV-1a hash of a feature vector
+static inline unsigned long long hash_node(unsigned long long h, const svm_node *x)
+{
+	const unsigned long long prime = 1099511628211ULL;
+	for(;x->index != -1;x++)
+	{
+		double v = x->value == 0? 0 : x->value;	// -0 == 0
+		unsigned long long bits;
+		memcpy(&bits,&v,sizeof(bits));
+		h = (h ^ (unsigned long long)x->index) * prime;
+		h = (h ^ bits) * prime;
+	}
+	return h;
+}
+
+static bool same_node(const svm_node *a, const svm_node *b)
+{
+	for(;a->index != -1;a++,b++)
+		if(a->index != b->index || a->value != b->value)
+			return false;
+	return b->index == -1;
+}
+
+// Frames whose features are identical, such as those of a rigid residue
+// in a quantized PDB ensemble, have identical kernel rows. Those of one
+// class are trained as one instance whose bound is C times their number;
+// its alpha is the sum that the frames could share. Takes the first l
+// entries of ws->perm in training order, keeps the first frame of each
+// instance there, fills ws->inst and ws->weight and returns the number
+// of instances.
+static int collapse_duplicates(const svm_problem *prob, svm_workspace *ws, int l)
+{
+	int size = 1;
+	while(size < 2*l)
+		size *= 2;
+	int *table = Malloc(int,size);	// open addressing, instance or -1
+	for(int k=0;k<size;k++)
+		table[k] = -1;
+
+	int n = 0;
+	for(int i=0;i<l;i++)
+	{
+		int f = ws->perm[i];
+		unsigned long long h = hash_node(14695981039346656037ULL ^ (unsigned long long)(long long)prob->y[f],prob->x[f]);
+		int k = (int)(h & (size-1));
+		for(;table[k] != -1;k=(k+1)&(size-1))
+		{
+			int g = ws->perm[table[k]];
+			if(prob->y[g] == prob->y[f] && same_node(prob->x[g],prob->x[f]))
+				break;
+		}
+		if(table[k] == -1)
+		{
+			table[k] = n;
+			ws->perm[n] = f;
+			ws->weight[n++] = 0;
+		}
+		ws->inst[f] = table[k];
+		++ws->weight[table[k]];
+	}
+	free(table);
+	return n;
+}
+
+static double *dense_features(const svm_problem *prob, int *d);
+
+// Greedy k-center (Gonzalez, 1985) in feature space, for each class on
+// its own: the first frame of the class is a center, and each next one
+// is the frame farthest from all centers so far. Every frame joins the
+// instance of its nearest center, as in collapse_duplicates, which it
+// replaces. The largest distance from a frame to its center is stored
+// in *radius; it is at most twice that of the best k centers.
+static int coreset_centers(const svm_problem *prob, svm_workspace *ws, int l, int np,
+			   int k, double *radius)
+{
+	int d;
+	double *xd = dense_features(prob,&d);	// problem order
+	int *order = Malloc(int,l);
+	double *dist = Malloc(double,l);	// to the nearest center, in training order
+	int *center = Malloc(int,l);
+	int i, n = 0;
+	memcpy(order,ws->perm,sizeof(int)*l);
+	*radius = 0;
+
+	for(int c=0;c<2;c++)
+	{
+		int begin = c == 0? 0 : np, end = c == 0? np : l;
+		int next = begin;
+		for(i=begin;i<end;i++)
+			dist[i] = INF;
+		for(int j=0;j<k && j<end-begin;j++)
+		{
+			const double *xc = xd+(size_t)order[next]*d;
+			double far = -1;
+			ws->perm[n] = order[next];
+			for(i=begin;i<end;i++)
+			{
+				const double *xi = xd+(size_t)order[i]*d;
+				double d2 = 0;
+				for(int t=0;t<d;t++)
+					d2 += (xi[t]-xc[t])*(xi[t]-xc[t]);
+				if(d2 < dist[i])
+				{
+					dist[i] = d2;
+					center[i] = n;
+				}
+				if(dist[i] > far)
+				{
+					far = dist[i];
+					next = i;
+				}
+			}
+			++n;
+			if(far == 0)
+				break;	// every frame is at a center
+		}
+		for(i=begin;i<end;i++)
+			*radius = max(*radius,dist[i]);
+	}
+	*radius = sqrt(*radius);
+
+	for(i=0;i<n;i++)
+		ws->weight[i] = 0;
+	for(i=0;i<l;i++)
+	{
+		ws->inst[order[i]] = center[i];
+		++ws->weight[center[i]];
+	}
+	free(xd);
+	free(order);
+	free(dist);
+	free(center);
+	return n;
+}
+
+// Frames of prob that are SVs of the solution over n instances, which
+// estimates the SVs of the full problem from a coreset solution. A center
+// is one if its instance has alpha > 0. Any other frame is one if its
+// center is, and it is inside the margin, y f(x) < 1 + eps; free SVs of a
+// solution to eps sit at y f(x) = 1 only within that tolerance. The
+// margin of a coreset solution is smoother than that of the full one, so
+// the margin test alone counts too many frames; a cluster whose center
+// is not an SV is taken to lie outside the margin as a whole.
+static void coreset_margin(const svm_problem *prob, const svm_parameter *param,
+			   const svm_workspace *ws, int n, double rho, int label_p,
+			   char *inside)
+{
+	int l = prob->l;
+	int nsv = 0;
+	int *sv = Malloc(int,n);
+	for(int j=0;j<n;j++)
+		if(ws->alpha[j] > 0)
+			sv[nsv++] = j;
+
+	int d = param->kernel_type == RBF? dense_dim(l,prob->x) : 0;
+	double *xd = NULL;
+	dense_fn dist = NULL;
+	if(d > 0)
+	{
+		dense_kernels(d,NULL,&dist);
+		xd = Malloc(double,(size_t)l*d);
+		densify(l,prob->x,d,xd);
+	}
+
+	int f;
+#pragma omp parallel for schedule(static) private(f)
+	for(f=0;f<l;f++)
+	{
+		int c = ws->inst[f];
+		if(ws->perm[c] == f || ws->alpha[c] == 0)
+			inside[f] = ws->alpha[c] > 0;
+		else
+		{
+			double sum = 0;
+			for(int s=0;s<nsv;s++)
+			{
+				int j = sv[s];
+				double k = xd? exp(-param->gamma*dist(&xd[(size_t)f*d],&xd[(size_t)ws->perm[j]*d],d)) :
+					       Kernel::k_function(prob->x[f],ws->x[j],*param);
+				sum += ws->alpha[j]*ws->y[j]*k;
+			}
+			double yf = ((int)prob->y[f] == label_p)? sum-rho : rho-sum;
+			inside[f] = yf < 1 + param->eps;
+		}
+	}
+	free(xd);
+	free(sv);
+}
+
+// Train a two-class C-SVC problem and return its number of SVs without
+// building an svm_model. Classes are ordered as in svm_train, so the
+// solution is the one svm_train would find. If sv_indices is not NULL,
+// the indices of the SVs in [1,...,prob->l] are stored in it in the
+// order of svm_model.sv_indices.
+int svm_train_nsv(const svm_problem *prob, const svm_parameter *param,
+		  svm_workspace *ws, int *sv_indices)
+{
+	return svm_train_nsv_from(prob,param,ws,NULL,sv_indices);
+}
+
+// Split the instances of a collapsed solution over n instances whose alpha
+// is free, 0 < alpha < weight*C, back into their frames. Identical frames
+// can share the alpha of their instance in any way; as SMO over the frames
+// tends to, it fills them to C in training order and leaves the rest at 0,
+// so the fewest frames are SVs. Frames of an instance at 0 or at its bound
+// are at 0 or at C in any solution over the frames, so those instances are
+// kept. Refills ws->perm, x, y, alpha and weight in training order and
+// ws->inst, and returns the new number of instances, or n if none was free.
+static int expand_free_instances(const svm_problem *prob, svm_workspace *ws, int l, int n,
+				 int label_p, double Cp, double Cn)
+{
+	int *unit = Malloc(int,n);	// new instance of a kept one, -1, or -2 if free
+	int j, nfree = 0;
+	for(j=0;j<n;j++)
+	{
+		bool free_j = ws->alpha[j] > 0 && ws->alpha[j] < ws->weight[j]*(ws->y[j] > 0? Cp : Cn);
+		unit[j] = free_j && ws->weight[j] > 1? -2 : -1;
+		if(unit[j] == -2)
+			++nfree;
+	}
+	if(nfree == 0)
+	{
+		free(unit);
+		return n;
+	}
+
+	int *old_inst = Malloc(int,l);
+	double *old_alpha = Malloc(double,n);	// what is left of a free one
+	double *old_weight = Malloc(double,n);
+	memcpy(old_inst,ws->inst,sizeof(int)*l);
+	memcpy(old_alpha,ws->alpha,sizeof(double)*n);
+	memcpy(old_weight,ws->weight,sizeof(double)*n);
+
+	// frames in training order, positive class first
+	int m = 0;
+	for(int c=0;c<2;c++)
+		for(int f=0;f<l;f++)
+		{
+			if(((int)prob->y[f] == label_p) != (c == 0))
+				continue;
+			j = old_inst[f];
+			if(unit[j] >= 0)
+			{
+				ws->inst[f] = unit[j];
+				continue;
+			}
+			ws->perm[m] = f;
+			ws->x[m] = prob->x[f];
+			ws->y[m] = c == 0? +1 : -1;
+			if(unit[j] == -2)
+			{
+				ws->alpha[m] = min(old_alpha[j],c == 0? Cp : Cn);
+				old_alpha[j] -= ws->alpha[m];
+				ws->weight[m] = 1;
+			}
+			else
+			{
+				ws->alpha[m] = old_alpha[j];
+				ws->weight[m] = old_weight[j];
+				unit[j] = m;
+			}
+			ws->inst[f] = m++;
+		}
+
+	free(unit);
+	free(old_inst);
+	free(old_alpha);
+	free(old_weight);
+	return m;
+}
+
+// Scale down the alphas of the class with the larger sum until y'alpha = 0,
+// which keeps a clipped start inside the box
+static void balance_alpha(int n, const schar *y, double *alpha)
+{
+	double sum_p = 0, sum_n = 0;
+	int i;
+	for(i=0;i<n;i++)
+		if(y[i] > 0)
+			sum_p += alpha[i];
+		else
+			sum_n += alpha[i];
+	double scale_p = sum_p > sum_n? sum_n/sum_p : 1;
+	double scale_n = sum_n > sum_p? sum_p/sum_n : 1;
+	for(i=0;i<n;i++)
+		alpha[i] *= y[i] > 0? scale_p : scale_n;
+}
+
+// svm_train_nsv starting from alpha0[0,prob->l), in problem order, or
+// from 0 if alpha0 is NULL. alpha0 is usually the solution of a problem
+// over the same frames (see svm_get_alpha); it is clipped to [0,C] and
+// the larger class sum is scaled down until y'alpha = 0. The solver
+// still stops at eps, but not necessarily at the solution it reaches
+// from 0, so nSV can differ from a cold start within that tolerance.
+// dc_clusters and sv_screen are not used with a start.
+//
+// With collapse_duplicates, frames of an instance at 0 or at its bound
+// are SVs if it is. Free instances are split into their frames, filled to
+// C in turn (see expand_free_instances), and the solution is polished over
+// them, so the SVs are those of a solution over the frames to eps. Which
+// of a group of identical free frames are SVs is still arbitrary, so the
+// count can differ from a run without collapsing by a frame or so per group.
+// With COLLAPSE_COPIES, every frame of an SV instance is one instead, which
+// counts each copy of a frame drawn more than once into a resample.
+// With coreset, instances are coreset_centers instead, and the SVs are
+// the frames inside the margin of their solution (see coreset_margin),
+// which approximates the SVs of the full problem. sv_screen and
+// mixed_precision are not used when frames were collapsed.
+int svm_train_nsv_from(const svm_problem *prob, const svm_parameter *param,
+		       svm_workspace *ws, const double *alpha0, int *sv_indices)
+{
+	if(param->svm_type != C_SVC)
+	{
+		fprintf(stderr,"ERROR: svm_train_nsv only supports C-SVC\n");
+		return -1;
+	}
+
+	int l = prob->l;
+	int i;
+	workspace_reserve(ws,l);
+	ws->l = 0;
+	memset(&ws->info,0,sizeof(ws->info));
+
+	int label_p, label_n;
+	int nclass = nsv_labels(prob,&label_p,&label_n);
+	if(nclass < 2)
+		return nclass;
+
+	// group the classes, positive first
+	int np = 0;
+	for(i=0;i<l;i++)
+		if((int)prob->y[i] == label_p)
+			ws->perm[np++] = i;
+	int npos = np;
+	for(i=0;i<l;i++)
+		if((int)prob->y[i] != label_p)
+			ws->perm[np++] = i;
+
+	// n instances in training order
+	int n = l;
+	double radius = 0;
+	if(param->coreset > 0)
+		n = coreset_centers(prob,ws,l,npos,param->coreset,&radius);
+	else if(param->collapse_duplicates)
+		n = collapse_duplicates(prob,ws,l);
+	else
+		for(i=0;i<l;i++)
+		{
+			ws->inst[ws->perm[i]] = i;
+			ws->weight[i] = 1;
+		}
+	bool collapsed = n < l;
+
+	schar *y = ws->y;
+	double *alpha = ws->alpha;
+	for(i=0;i<n;i++)
+	{
+		ws->x[i] = prob->x[ws->perm[i]];
+		y[i] = ((int)prob->y[ws->perm[i]] == label_p)? +1 : -1;
+		alpha[i] = 0;
+	}
+	svm_problem sub_prob;
+	sub_prob.l = n;
+	sub_prob.x = ws->x;
+	sub_prob.y = NULL;
+
+	double Cp, Cn;
+	nsv_weights(param,label_p,label_n,&Cp,&Cn);
+
+	// iterations and time of the dc_clusters and sv_screen sub-solves
+	// count towards the budgets, but only the final solve is stopped
+	double time_limit = param->max_time > 0? svm_wall_time() + param->max_time : 0;
+	if(param->deadline > 0 && (time_limit == 0 || param->deadline < time_limit))
+		time_limit = param->deadline;
+	long iter = 0;
+	if(alpha0)
+	{
+		for(i=0;i<l;i++)
+		{
+			int j = ws->inst[i];
+			alpha[j] += min(max(alpha0[i],0.0),y[j] > 0? Cp : Cn);
+		}
+		balance_alpha(n,y,alpha);
+	}
+	else if(param->dc_clusters > 1 && n >= 2*param->dc_clusters)
+	{
+		// the clusters are solved with the plain bounds, which are
+		// within the weighted ones of collapsed frames
+		dc_warm_start(&sub_prob,param,y,Cp,Cn,alpha,&iter);
+	}
+
+	double gap = 0, rho = 0;
+	bool stopped = false;
+
+	{
+		Solver::SolutionInfo si;
+		Solver s(ws);
+		s.weight = collapsed? ws->weight : NULL;
+		SVC_Q Q(sub_prob,*param,y,ws);
+		// a screened solution goes straight to the double solve
+		bool screened = !alpha0 && !collapsed && param->sv_screen > 0 && param->dc_clusters <= 1 &&
+				screen_solve(&sub_prob,param,y,Q,Cp,Cn,alpha,&iter);
+		bool solved = false;
+		if(!screened && param->mixed_precision && !collapsed)
+		{
+			// most iterations run on a float gradient; the double solve
+			// then starts from its alpha with an exact gradient and only
+			// stops once the KKT conditions hold to eps. Not with collapsed
+			// frames, whose large bounds cost the float gradient too much
+			// precision; it then takes more iterations than it saves
+			SolverT<float>::SolutionInfo fsi;
+			SolverT<float> fs(ws);
+			fs.keep_order = true;
+			fs.iter_limit = param->max_iter > 0? (int)max(param->max_iter-iter,1L) : 0;
+			fs.time_limit = time_limit;
+			fs.Solve(n, Q, ws->minus_ones, y,
+				 alpha, Cp, Cn, param->eps, &fsi, param->shrinking);
+			iter += fsi.iter;
+			gap = fsi.gap;
+			stopped = solved = fsi.stopped;
+		}
+		if(!solved)
+		{
+			s.iter_limit = param->max_iter > 0? (int)max(param->max_iter-iter,1L) : 0;
+			s.time_limit = time_limit;
+			s.Solve(n, Q, ws->minus_ones, y,
+				alpha, Cp, Cn, param->eps, &si, param->shrinking);
+			iter += si.iter;
+			gap = si.gap;
+			stopped = si.stopped;
+			rho = si.rho;
+		}
+		Q.get_cache_stats(&ws->info);
+	}
+	if(collapsed && param->coreset <= 0 && param->collapse_duplicates != COLLAPSE_COPIES && !stopped)
+	{
+		// split free instances into their frames and polish the
+		// solution, so that the SVs are those of a solution over
+		// the frames rather than of one over their instances
+		int m = expand_free_instances(prob,ws,l,n,label_p,Cp,Cn);
+		if(m > n)
+		{
+			Solver::SolutionInfo si;
+			Solver s(ws);
+			s.weight = ws->weight;
+			s.iter_limit = param->max_iter > 0? (int)max(param->max_iter-iter,1L) : 0;
+			s.time_limit = time_limit;
+			sub_prob.l = m;
+			SVC_Q Q(sub_prob,*param,y,ws);
+			s.Solve(m, Q, ws->minus_ones, y,
+				alpha, Cp, Cn, param->eps, &si, param->shrinking);
+			iter += si.iter;
+			gap = si.gap;
+			stopped = si.stopped;
+		}
+	}
+	ws->info.iterations = iter;
+	ws->info.kkt_gap = gap;
+	ws->info.stopped = stopped;
+	ws->info.instances = n;
+	ws->info.coreset_radius = radius;
+	ws->l = l;
+
+	char *inside = NULL;
+	if(param->coreset > 0 && collapsed)
+	{
+		inside = Malloc(char,l);
+		coreset_margin(prob,param,ws,n,rho,label_p,inside);
+	}
+
+	// frames in training order, positive class first
+	int nSV = 0;
+	for(int c=0;c<2;c++)
+		for(i=0;i<l;i++)
+			if(((int)prob->y[i] == label_p) == (c == 0) &&
+			   (inside? inside[i] : alpha[ws->inst[i]] > 0))
+			{
+				if(sv_indices)
+					sv_indices[nSV] = i+1;
+				++nSV;
+			}
+	free(inside);
+
+	info("nSV = %d\n",nSV);
+	return nSV;
+}
+
+// Wall-clock seconds, the clock of svm_parameter.deadline
+double svm_wall_time(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return (double)tv.tv_sec + 1e-6*(double)tv.tv_usec;
+}
+
+// Statistics of the last svm_train_nsv with this workspace
+void svm_get_solve_info(const svm_workspace *ws, svm_solve_info *info)
+{
+	*info = ws->info;
+}
+
+// Store the alphas of the last svm_train_nsv with this workspace in
+// alpha, in problem order, and return their number (0 if that problem
+// was not solved, e.g. it had one class)
+int svm_get_alpha(const svm_workspace *ws, double *alpha)
+{
+	// identical frames share the alpha of their instance
+	for(int i=0;i<ws->l;i++)
+		alpha[i] = ws->alpha[ws->inst[i]] / ws->weight[ws->inst[i]];
+	return ws->l;
+}
+
+//
+// Approximate training in an explicit feature space. The RBF kernel is
+// exp(-gamma*|x-y|^2) = E[cos(w'(x-y))] for w ~ N(0,2*gamma*I), so with
+// ndim random w_k and phases b_k the features
+//	z_k(x) = sqrt(2/ndim)*cos(w_k'x + b_k)
+// have z(x)'z(y) close to K(x,y), with an error of order 1/sqrt(ndim)
+// (Rahimi and Recht, NIPS 2007). A linear C-SVC on z costs O(l*ndim)
+// per pass instead of the O(l^2) kernel evaluations of SMO.
+//
+
+// xorshift64*, so that features depend on the seed only and not on
+// the state of rand() shared with other threads
+static inline double rng_uniform(unsigned long long *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return (double)((*state * 2685821657736338717ULL) >> 11) * (1.0/9007199254740992.0);
+}
+
+static inline double rng_normal(unsigned long long *state)
+{
+	double u = rng_uniform(state), v = rng_uniform(state);
+	return sqrt(-2*log(1-u))*cos(2*M_PI*v);
+}
+
+// the features of prob as a row-major l x d array, 0 where a node is missing
+static double *dense_features(const svm_problem *prob, int *d)
+{
+	int l = prob->l;
+	int i;
+	*d = dense_dim(l,prob->x);
+	if(*d == 0)
+		for(i=0;i<l;i++)
+			for(const svm_node *px=prob->x[i];px->index!=-1;px++)
+				*d = max(*d,px->index);
+	double *xd = Malloc(double,(size_t)l*max(*d,1));
+	if(dense_dim(l,prob->x) == *d)
+		densify(l,prob->x,*d,xd);
+	else
+	{
+		memset(xd,0,sizeof(double)*(size_t)l*(*d));
+		for(i=0;i<l;i++)
+			for(const svm_node *px=prob->x[i];px->index!=-1;px++)
+				xd[(size_t)i*(*d)+px->index-1] = px->value;
+	}
+	return xd;
+}
+
+#define LINEAR_MAX_EPOCHS 1000
+#define LINEAR_EPS 0.1	// LIBLINEAR's default for the dual solvers
+
+// Dual coordinate descent for the L1-loss linear SVM without the
+// equality constraint, as in LIBLINEAR (Hsieh et al., ICML 2008): each
+// step solves for one alpha_i exactly and updates w = sum alpha_i y_i z_i.
+// Bounded alphas whose gradient points outside are shrunk, as in
+// LIBLINEAR's solve_l2r_l1l2_svc. z is row-major l x n; the bias is an
+// extra feature equal to 1. It stops when the projected gradients span
+// less than eps, or with a warning after LINEAR_MAX_EPOCHS epochs.
+// Returns the number of alpha_i > 0.
+static int linear_dual_cd(const float *z, int l, int n, const schar *y,
+			  double Cp, double Cn, double eps,
+			  unsigned long long *state, double *alpha)
+{
+	double *w = Malloc(double,n+1);
+	double *QD = Malloc(double,l);
+	int *index = Malloc(int,l);
+	int i, k, s;
+
+	for(k=0;k<=n;k++)
+		w[k] = 0;
+	for(i=0;i<l;i++)
+	{
+		const float *zi = &z[(size_t)i*n];
+		QD[i] = 1;	// the bias feature
+		for(k=0;k<n;k++)
+			QD[i] += (double)zi[k]*zi[k];
+		alpha[i] = 0;
+		index[i] = i;
+	}
+
+	int active_size = l;
+	double PGmax_old = INF, PGmin_old = -INF;
+	int epoch;
+	for(epoch=0;epoch<LINEAR_MAX_EPOCHS;epoch++)
+	{
+		for(s=0;s<active_size;s++)
+			swap(index[s],index[s+(int)(rng_uniform(state)*(active_size-s))]);
+
+		double PGmax = -INF, PGmin = INF;
+		for(s=0;s<active_size;s++)
+		{
+			i = index[s];
+			const float *zi = &z[(size_t)i*n];
+			double C = y[i] > 0? Cp : Cn;
+			double G = w[n];
+			for(k=0;k<n;k++)
+				G += w[k]*zi[k];
+			G = G*y[i] - 1;
+
+			double PG = 0;
+			if(alpha[i] == 0)
+			{
+				if(G > PGmax_old)
+				{
+					swap(index[s--],index[--active_size]);
+					continue;
+				}
+				if(G < 0)
+					PG = G;
+			}
+			else if(alpha[i] == C)
+			{
+				if(G < PGmin_old)
+				{
+					swap(index[s--],index[--active_size]);
+					continue;
+				}
+				if(G > 0)
+					PG = G;
+			}
+			else
+				PG = G;
+			PGmax = max(PGmax,PG);
+			PGmin = min(PGmin,PG);
+			if(fabs(PG) < 1e-12)
+				continue;
+
+			double old = alpha[i];
+			alpha[i] = min(max(alpha[i] - G/QD[i],0.0),C);
+			double d = (alpha[i] - old)*y[i];
+			for(k=0;k<n;k++)
+				w[k] += d*zi[k];
+			w[n] += d;
+		}
+
+		if(PGmax - PGmin <= eps)
+		{
+			if(active_size == l)
+				break;
+			// check the shrunk alphas too
+			active_size = l;
+			PGmax_old = INF;
+			PGmin_old = -INF;
+			continue;
+		}
+		PGmax_old = PGmax > 0? PGmax : INF;
+		PGmin_old = PGmin < 0? PGmin : -INF;
+	}
+	if(epoch == LINEAR_MAX_EPOCHS)
+		fprintf(stderr,"\nWARNING: linear dual CD reached %d epochs without converging\n",epoch);
+	else
+		++epoch;	// the epoch that converged
+	info("linear dual CD: %d epochs\n",epoch);
+
+	int nSV = 0;
+	for(i=0;i<l;i++)
+		nSV += alpha[i] > 0;
+	free(w);
+	free(QD);
+	free(index);
+	return nSV;
+}
+
+// svm_train_nsv for an RBF kernel, approximated by a linear C-SVC on
+// ndim random Fourier features drawn from seed. Returns the number of
+// nonzero alphas, or as svm_train_nsv for one class or bad labels.
+int svm_train_nsv_rff(const svm_problem *prob, const svm_parameter *param,
+		      int ndim, unsigned int seed)
+{
+	if(param->svm_type != C_SVC || param->kernel_type != RBF)
+	{
+		fprintf(stderr,"ERROR: svm_train_nsv_rff only supports C-SVC with an RBF kernel\n");
+		return -1;
+	}
+
+	int l = prob->l;
+	int i, k, j;
+	int label_p, label_n;
+	int nclass = nsv_labels(prob,&label_p,&label_n);
+	if(nclass < 2)
+		return nclass;
+	double Cp, Cn;
+	nsv_weights(param,label_p,label_n,&Cp,&Cn);
+
+	int d;
+	double *xd = dense_features(prob,&d);
+	unsigned long long state = 0x9E3779B97F4A7C15ULL ^ seed;
+	double *W = Malloc(double,(size_t)ndim*d);
+	double *b = Malloc(double,ndim);
+	double sigma = sqrt(2*param->gamma);
+	for(k=0;k<ndim;k++)
+	{
+		for(j=0;j<d;j++)
+			W[(size_t)k*d+j] = sigma*rng_normal(&state);
+		b[k] = 2*M_PI*rng_uniform(&state);
+	}
+
+	float *z = Malloc(float,(size_t)l*ndim);
+	double scale = sqrt(2.0/ndim);
+	for(i=0;i<l;i++)
+	{
+		const double *xi = &xd[(size_t)i*d];
+		for(k=0;k<ndim;k++)
+		{
+			const double *wk = &W[(size_t)k*d];
+			double t = b[k];
+			for(j=0;j<d;j++)
+				t += wk[j]*xi[j];
+			z[(size_t)i*ndim+k] = (float)(scale*cos(t));
+		}
+	}
+	free(xd);
+	free(W);
+	free(b);
+
+	schar *y = Malloc(schar,l);
+	for(i=0;i<l;i++)
+		y[i] = ((int)prob->y[i] == label_p)? +1 : -1;
+	double *alpha = Malloc(double,l);
+	int nSV = linear_dual_cd(z,l,ndim,y,Cp,Cn,LINEAR_EPS,&state,alpha);
+
+	free(z);
+	free(y);
+	free(alpha);
+	info("nSV = %d\n",nSV);
+	return nSV;
 }
 
-// Stratified cross validation
-void svm_cross_validation(const svm_problem *prob, const svm_parameter *param, int nr_fold, double *target)
+// svm_train_nsv for a linear SVM on the features of prob, whatever the
+// kernel of param, by the dual coordinate descent of svm_train_nsv_rff.
+// It is much cheaper than SMO with a kernel. Its nSV says nothing certain
+// about the nSV with another kernel; callers use it as a screen only.
+int svm_train_nsv_linear(const svm_problem *prob, const svm_parameter *param)
 {
-	int i;
-	int *fold_start;
+	if(param->svm_type != C_SVC)
+	{
+		fprintf(stderr,"ERROR: svm_train_nsv_linear only supports C-SVC\n");
+		return -1;
+	}
+
 	int l = prob->l;
-	int *perm = Malloc(int,l);
-	int nr_class;
-	if (nr_fold > l)
+	int i;
+	int label_p, label_n;
+	int nclass = nsv_labels(prob,&label_p,&label_n);
+	if(nclass < 2)
+		return nclass;
+	double Cp, Cn;
+	nsv_weights(param,label_p,label_n,&Cp,&Cn);
+
+	int d;
+	double *xd = dense_features(prob,&d);
+	float *z = Malloc(float,(size_t)l*d);
+	for(size_t k=0;k<(size_t)l*d;k++)
+		z[k] = (float)xd[k];
+	free(xd);
+
+	schar *y = Malloc(schar,l);
+	for(i=0;i<l;i++)
+		y[i] = ((int)prob->y[i] == label_p)? +1 : -1;
+	double *alpha = Malloc(double,l);
+	unsigned long long state = 0x9E3779B97F4A7C15ULL;
+	int nSV = linear_dual_cd(z,l,d,y,Cp,Cn,LINEAR_EPS,&state,alpha);
+
+	free(z);
+	free(y);
+	free(alpha);
+	info("nSV = %d\n",nSV);
+	return nSV;
+}
+
+//
+// Features of several problems over the same frames, frame-major, and
+// within a frame feature-major: x[(f*maxdim+k)*lanes+r] is feature k of
+// problem r in frame f, zero past the problem's dimension; lanes is
+// nprobs rounded up to a multiple of FRAME_LANES. The squared
+// distances of a frame pair are computed for the whole group together,
+// one problem per SIMD lane, so each frame is loaded once for the group
+// and the sums of different problems run in parallel. Each lane still
+// adds its terms in index order, so the distances are exactly those of
+// the dense kernels.
+//
+struct svm_frame_block
+{
+	int l;		// number of frames
+	int nprobs;
+	int lanes;
+	int maxdim;	// largest number of features
+	double *x;	// l x maxdim x lanes
+};
+
+#define FRAME_LANES 8
+
+// Returns NULL unless all problems are dense and have the same number of
+// vectors.
+svm_frame_block *svm_frame_block_create(const svm_problem *probs, int nprobs)
+{
+	int l = probs[0].l;
+	int r, i, k;
+	int *dim = Malloc(int,nprobs);
+	int maxdim = 0;
+	for(r=0;r<nprobs;r++)
 	{
-		nr_fold = l;
-		fprintf(stderr,"WARNING: # folds > # data. Will use # folds = # data instead (i.e., leave-one-out cross validation)\n");
+		dim[r] = probs[r].l == l? dense_dim(l,probs[r].x) : 0;
+		if(dim[r] == 0)
+		{
+			free(dim);
+			return NULL;
+		}
+		maxdim = max(maxdim,dim[r]);
 	}
-	fold_start = Malloc(int,nr_fold+1);
-	// stratified cv may not give leave-one-out rate
-	// Each class to l folds -> some folds may have zero elements
-	if((param->svm_type == C_SVC ||
-	    param->svm_type == NU_SVC) && nr_fold < l)
+
+	svm_frame_block *block = Malloc(svm_frame_block,1);
+	block->l = l;
+	block->nprobs = nprobs;
+	block->lanes = (nprobs+FRAME_LANES-1)/FRAME_LANES*FRAME_LANES;
+	block->maxdim = maxdim;
+	int lanes = block->lanes;
+	block->x = Malloc(double,(size_t)l*maxdim*lanes);
+	for(i=0;i<l;i++)
 	{
-		int *start = NULL;
-		int *label = NULL;
-		int *count = NULL;
-		svm_group_classes(prob,&nr_class,&label,&start,&count,perm);
+		double *row = &block->x[(size_t)i*maxdim*lanes];
+		for(k=0;k<maxdim;k++)
+			for(r=0;r<lanes;r++)
+				row[k*lanes+r] = r < nprobs && k < dim[r]? probs[r].x[i][k].value : 0;
+	}
+	free(dim);
+	return block;
+}
 
-		// random shuffle and then data grouped by fold using the array perm
-		int *fold_count = Malloc(int,nr_fold);
-		int c;
-		int *index = Malloc(int,l);
-		for(i=0;i<l;i++)
-			index[i]=perm[i];
-		for (c=0; c<nr_class; c++) 
-			for(i=0;i<count[c];i++)
-			{
-				int j = i+rand()%(count[c]-i);
-				swap(index[start[c]+j],index[start[c]+i]);
-			}
-		for(i=0;i<nr_fold;i++)
+void svm_frame_block_destroy(svm_frame_block *block)
+{
+	free(block->x);
+	free(block);
+}
+
+// Squared distances between frames xi and xj of lanes r0,...,r0+7. Each
+// lane sums its features in index order.
+static inline void frame_pair(const double *xi, const double *xj, int r0,
+			      int width, int lanes, double *sum)
+{
+	int k, q;
+	for(q=0;q<FRAME_LANES;q++)
+		sum[q] = 0;
+	for(k=r0;k<width;k+=lanes)
+		for(q=0;q<FRAME_LANES;q++)
 		{
-			fold_count[i] = 0;
-			for (c=0; c<nr_class;c++)
-				fold_count[i]+=(i+1)*count[c]/nr_fold-i*count[c]/nr_fold;
+			double t = xi[k+q]-xj[k+q];
+			sum[q] += t*t;
 		}
-		fold_start[0]=0;
-		for (i=1;i<=nr_fold;i++)
-			fold_start[i] = fold_start[i-1]+fold_count[i-1];
-		for (c=0; c<nr_class;c++)
-			for(i=0;i<nr_fold;i++)
+}
+
+#ifdef SVM_SIMD
+// frame_pair for xi against both xj and xk in AVX2, with the same sums as
+// frame_pair; the four accumulators are independent and hide the latency
+// of the additions
+SIMD_TARGET static void frame_pair2(const double *xi, const double *xj, const double *xk,
+			       int r0, int width, int lanes, double *sum_j, double *sum_k)
+{
+	__m256d s0 = _mm256_setzero_pd();
+	__m256d s1 = _mm256_setzero_pd();
+	__m256d s2 = _mm256_setzero_pd();
+	__m256d s3 = _mm256_setzero_pd();
+	for(int k=r0;k<width;k+=lanes)
+	{
+		__m256d a0 = _mm256_loadu_pd(xi+k);
+		__m256d a1 = _mm256_loadu_pd(xi+k+4);
+		__m256d t0 = _mm256_sub_pd(a0,_mm256_loadu_pd(xj+k));
+		__m256d t1 = _mm256_sub_pd(a1,_mm256_loadu_pd(xj+k+4));
+		__m256d t2 = _mm256_sub_pd(a0,_mm256_loadu_pd(xk+k));
+		__m256d t3 = _mm256_sub_pd(a1,_mm256_loadu_pd(xk+k+4));
+		s0 = _mm256_add_pd(s0,_mm256_mul_pd(t0,t0));
+		s1 = _mm256_add_pd(s1,_mm256_mul_pd(t1,t1));
+		s2 = _mm256_add_pd(s2,_mm256_mul_pd(t2,t2));
+		s3 = _mm256_add_pd(s3,_mm256_mul_pd(t3,t3));
+	}
+	_mm256_storeu_pd(sum_j,s0);
+	_mm256_storeu_pd(sum_j+4,s1);
+	_mm256_storeu_pd(sum_k,s2);
+	_mm256_storeu_pd(sum_k+4,s3);
+}
+#endif
+
+// Rows [i0,i1) of the squared distance matrix of every problem, d2[r]
+// being l x l. Only columns j >= i are filled; svm_frame_block_mirror
+// fills the rest once all rows are done. Frames are visited in tiles of
+// FRAME_TILE so that the rows being compared stay in cache.
+#define FRAME_TILE 64
+void svm_frame_block_sq_dist(const svm_frame_block *block, int i0, int i1, float **d2)
+{
+	int l = block->l;
+	int np = block->nprobs;
+	int lanes = block->lanes;
+	int width = block->maxdim*lanes;
+	double sum[FRAME_LANES];
+#ifdef SVM_SIMD
+	double sum2[FRAME_LANES];
+#endif
+	for(int j0=i0;j0<l;j0+=FRAME_TILE)
+	{
+		int j1 = min(j0+FRAME_TILE,l);
+		for(int i=i0;i<i1;i++)
+		{
+			const double *xi = &block->x[(size_t)i*width];
+			for(int r0=0;r0<np;r0+=FRAME_LANES)
 			{
-				int begin = start[c]+i*count[c]/nr_fold;
-				int end = start[c]+(i+1)*count[c]/nr_fold;
-				for(int j=begin;j<end;j++)
+				int nq = min(FRAME_LANES,np-r0);
+				int j = max(i,j0);
+#ifdef SVM_SIMD
+				for(;simd_ok && j+2<=j1;j+=2)
 				{
-					perm[fold_start[i]] = index[j];
-					fold_start[i]++;
+					frame_pair2(xi,&block->x[(size_t)j*width],&block->x[(size_t)(j+1)*width],
+						    r0,width,lanes,sum,sum2);
+					for(int q=0;q<nq;q++)
+					{
+						d2[r0+q][(size_t)i*l+j] = (float)sum[q];
+						d2[r0+q][(size_t)i*l+j+1] = (float)sum2[q];
+					}
+				}
+#endif
+				for(;j<j1;j++)
+				{
+					frame_pair(xi,&block->x[(size_t)j*width],r0,width,lanes,sum);
+					for(int q=0;q<nq;q++)
+						d2[r0+q][(size_t)i*l+j] = (float)sum[q];
 				}
 			}
-		fold_start[0]=0;
-		for (i=1;i<=nr_fold;i++)
-			fold_start[i] = fold_start[i-1]+fold_count[i-1];
-		free(start);
-		free(label);
-		free(count);
-		free(index);
-		free(fold_count);
+		}
 	}
-	else
+}
+
+void svm_frame_block_mirror(const svm_frame_block *block, int i0, int i1, float **d2)
+{
+	int l = block->l;
+	for(int r=0;r<block->nprobs;r++)
+		for(int j=0;j<i1;j++)
+			for(int i=max(i0,j+1);i<i1;i++)
+				d2[r][(size_t)i*l+j] = d2[r][(size_t)j*l+i];
+}
+
+// Train a two-class C-SVC problem at every (gamma, C) pair of a grid and
+// store the number of SVs of each in nSV[ig*nC+ic]. The label of
+// prob->y[0] is the positive class. svm_train instead makes +1 the
+// positive class when a -1/+1 problem starts with -1, but swapping the
+// classes does not change nSV. C is visited in increasing order, and
+// each solve starts from the solution at the previous C, which is
+// still inside the larger box. ws provides the solver buffers, as in
+// svm_train_nsv. d2, if not NULL, is the l x l squared distance matrix
+// of prob, for example from svm_frame_block_sq_dist; otherwise one is
+// computed if it fits in the cache and several gammas share it.
+void svm_sweep_nsv(const svm_problem *prob, const svm_parameter *param,
+		   int ngamma, const double *gamma, int nC, const double *C,
+		   const float *d2, svm_workspace *ws, int *nSV)
+{
+	int l = prob->l;
+	int i, ig, ic;
+	workspace_reserve(ws,l);
+	schar *y = ws->y;
+	double *minus_ones = ws->minus_ones;
+	double *alpha = ws->alpha;
+	int *order = Malloc(int,nC);
+
+	for(i=0;i<l;i++)
+		y[i] = (prob->y[i] == prob->y[0])? +1 : -1;
+
+	// visit C in increasing order so that the previous alpha stays feasible
+	for(ic=0;ic<nC;ic++)
+		order[ic] = ic;
+	for(ic=1;ic<nC;ic++)
+		for(int k=ic;k>0 && C[order[k-1]] > C[order[k]];k--)
+			swap(order[k-1],order[k]);
+
+	// squared distances are worth keeping only if several gammas reuse them
+	bool keep_d2 = ngamma > 1 &&
+		(double)l*l*sizeof(float) <= param->cache_size*(1<<20);
+	SweepQ Q(*prob,*param,y,keep_d2,d2);
+
+	for(ig=0;ig<ngamma;ig++)
 	{
-		for(i=0;i<l;i++) perm[i]=i;
+		Q.set_gamma(gamma[ig]);
 		for(i=0;i<l;i++)
+			alpha[i] = 0;
+		for(ic=0;ic<nC;ic++)
 		{
-			int j = i+rand()%(l-i);
-			swap(perm[i],perm[j]);
+			double c = C[order[ic]];
+
+			Solver::SolutionInfo si;
+			Solver s(ws);
+			s.Solve(l, Q, minus_ones, y, alpha, c, c, param->eps, &si, param->shrinking);
+			Q.restore();
+
+			int n = 0;
+			for(i=0;i<l;i++)
+				if(alpha[i] > 0) ++n;
+			info("gamma = %g, C = %g, nSV = %d\n", gamma[ig], c, n);
+			nSV[ig*nC+order[ic]] = n;
 		}
-		for(i=0;i<=nr_fold;i++)
-			fold_start[i]=i*l/nr_fold;
 	}
 
-	for(i=0;i<nr_fold;i++)
+	free(order);
+}
+
+// Kernel matrix of prob under the kernel of param, as l x l floats in
+// problem order, or NULL if it does not fit in memory. A labeling of the
+// same frames, e.g. a permutation of prob->y, can then be trained with
+// svm_train_nsv_kernel without computing a kernel value again.
+float *svm_kernel_matrix(const svm_problem *prob, const svm_parameter *param)
+{
+	int l = prob->l;
+	float *K = (float *)malloc(sizeof(float)*(size_t)l*l);
+	if(K)
+		svm_kernel_matrix_from(prob,param,NULL,0,NULL,K);
+	return K;
+}
+
+// Fill the l x l kernel matrix K of prob, copying the entries of frames
+// that were also in a previous problem from its l_old x l_old kernel
+// matrix K_old. old_index[i] is the index in the previous problem of
+// frame i, or -1 if it is new. For overlapping windows of a trajectory
+// only the rows and columns of the new frames are computed. K_old and
+// old_index may be NULL to compute all of K.
+void svm_kernel_matrix_from(const svm_problem *prob, const svm_parameter *param,
+			    const float *K_old, int l_old, const int *old_index, float *K)
+{
+	int l = prob->l;
+	int dim = param->kernel_type == RBF? dense_dim(l,prob->x) : 0;
+	double *xd = NULL;
+	dense_fn dist;
+	if(dim > 0)
 	{
-		int begin = fold_start[i];
-		int end = fold_start[i+1];
-		int j,k;
-		struct svm_problem subprob;
+		dense_kernels(dim,NULL,&dist);
+		xd = Malloc(double,(size_t)l*dim);
+		densify(l,prob->x,dim,xd);
+	}
+	int i;
+#pragma omp parallel for schedule(dynamic) private(i)
+	for(i=0;i<l;i++)
+	{
+		int oi = K_old? old_index[i] : -1;
+		if(oi >= 0)
+			K[(size_t)i*l+i] = K_old[(size_t)oi*l_old+oi];
+		else if(xd)
+			K[(size_t)i*l+i] = 1;	// exp(-gamma*0)
+		else
+			K[(size_t)i*l+i] = (float)Kernel::k_function(prob->x[i],prob->x[i],*param);
+		for(int j=i+1;j<l;j++)
+		{
+			int oj = K_old? old_index[j] : -1;
+			double k;
+			if(oi >= 0 && oj >= 0)
+				k = K_old[(size_t)oi*l_old+oj];
+			else if(xd)
+				k = exp(-param->gamma*dist(&xd[(size_t)i*dim],&xd[(size_t)j*dim],dim));
+			else
+				k = Kernel::k_function(prob->x[i],prob->x[j],*param);
+			K[(size_t)i*l+j] = (float)k;
+		}
+	}
+	// lower triangle from the upper one
+#pragma omp parallel for schedule(static) private(i)
+	for(i=1;i<l;i++)
+		for(int j=0;j<i;j++)
+			K[(size_t)i*l+j] = K[(size_t)j*l+i];
+	free(xd);
+}
 
-		subprob.l = l-(end-begin);
-		subprob.x = Malloc(struct svm_node*,subprob.l);
-		subprob.y = Malloc(double,subprob.l);
-			
-		k=0;
-		for(j=0;j<begin;j++)
+//
+// Q matrix of a labeling of frames whose kernel matrix is shared. Missing
+// columns are gathered from K with the signs of this labeling, which costs
+// no kernel evaluations, but still enough that the usual cache pays off.
+//
+class KernelMatrixQ: public QMatrix
+{
+public:
+	// instance i is row rows[i] of the l_K x l_K matrix K
+	KernelMatrixQ(int l_, const float *K_, int l_K, const int *rows, const schar *y_,
+		      const svm_parameter& param)
+	:l(l_), ld(l_K), K(K_)
+	{
+		clone(y,y_,l);
+		clone(idx,rows,l);
+		QD = new double[l];
+		for(int i=0;i<l;i++)
+			QD[i] = K[(size_t)idx[i]*ld+idx[i]];
+		cache = new Cache(l,(long int)(param.cache_size*(1<<20)),param.cache_policy);
+	}
+
+	Qfloat *get_Q(int i, int len) const
+	{
+		Qfloat *data;
+		int start;
+		if((start = cache->get_data(i,&data,len)) < len)
 		{
-			subprob.x[k] = prob->x[perm[j]];
-			subprob.y[k] = prob->y[perm[j]];
-			++k;
+			const float *K_i = &K[(size_t)idx[i]*ld];
+			for(int j=start;j<len;j++)
+				data[j] = (Qfloat)(y[i]*y[j]*K_i[idx[j]]);
 		}
-		for(j=end;j<l;j++)
+		return data;
+	}
+
+	double *get_QD() const
+	{
+		return QD;
+	}
+
+	void swap_index(int i, int j) const
+	{
+		cache->swap_index(i,j);
+		swap(y[i],y[j]);
+		swap(idx[i],idx[j]);
+		swap(QD[i],QD[j]);
+	}
+
+	void set_free(int i, bool is_free) const
+	{
+		cache->set_pinned(i,is_free);
+	}
+
+	~KernelMatrixQ()
+	{
+		delete[] y;
+		delete[] idx;
+		delete[] QD;
+		delete cache;
+	}
+private:
+	int l;
+	int ld;		// rows and columns of K
+	const float *K;	// kernel matrix in original order
+	schar *y;
+	int *idx;	// row of K of each position
+	double *QD;
+	Cache *cache;
+};
+
+// svm_train_nsv_from for a C-SVC problem with the kernel matrix K from
+// svm_kernel_matrix, so prob->x is not used. K is only read, so threads
+// with their own workspaces can train different labelings of the same
+// frames at once. Classes are grouped as in svm_train_nsv. Of param, only
+// C, the class weights, eps, shrinking, cache_size, cache_policy and
+// max_iter are used, so it trains what svm_train_nsv does with a float
+// cache and without kernel_drop, dc_clusters, sv_screen, mixed_precision,
+// collapse_duplicates and coreset. alpha0, if not NULL, is clipped and
+// balanced as in svm_train_nsv_from.
+int svm_train_nsv_kernel(const svm_problem *prob, const svm_parameter *param,
+			 const float *K, const double *alpha0, svm_workspace *ws)
+{
+	return svm_train_nsv_kernel_rows(prob,param,K,prob->l,NULL,alpha0,ws);
+}
+
+// svm_train_nsv_kernel for frames that are rows of a larger kernel
+// matrix: frame i of prob is row rows[i] of the l_K x l_K matrix K, or
+// row i if rows is NULL. Frames of a class that share a row, such as the
+// copies of a frame drawn into a bootstrap resample, are trained as one
+// instance with a multiple of C, and each counts as an SV if the instance
+// is one, as with COLLAPSE_COPIES.
+int svm_train_nsv_kernel_rows(const svm_problem *prob, const svm_parameter *param,
+			      const float *K, int l_K, const int *rows,
+			      const double *alpha0, svm_workspace *ws)
+{
+	if(param->svm_type != C_SVC)
+	{
+		fprintf(stderr,"ERROR: svm_train_nsv_kernel only supports C-SVC\n");
+		return -1;
+	}
+
+	int l = prob->l;
+	int i;
+	workspace_reserve(ws,l);
+	ws->l = 0;
+	memset(&ws->info,0,sizeof(ws->info));
+
+	int label_p, label_n;
+	int nclass = nsv_labels(prob,&label_p,&label_n);
+	if(nclass < 2)
+		return nclass;
+
+	// n instances in training order, positive class first, the first
+	// frame of each row and class
+	int *row_inst = Malloc(int,l_K);	// instance of a row in the class
+	int *inst_row = Malloc(int,l);
+	schar *y = ws->y;
+	double *alpha = ws->alpha;
+	int n = 0;
+	for(int c=0;c<2;c++)
+	{
+		for(i=0;i<l_K;i++)
+			row_inst[i] = -1;
+		for(i=0;i<l;i++)
 		{
-			subprob.x[k] = prob->x[perm[j]];
-			subprob.y[k] = prob->y[perm[j]];
-			++k;
+			if(((int)prob->y[i] == label_p) != (c == 0))
+				continue;
+			int r = rows? rows[i] : i;
+			if(row_inst[r] < 0)
+			{
+				row_inst[r] = n;
+				ws->perm[n] = i;
+				inst_row[n] = r;
+				y[n] = c == 0? +1 : -1;
+				alpha[n] = 0;
+				ws->weight[n++] = 0;
+			}
+			ws->inst[i] = row_inst[r];
+			++ws->weight[row_inst[r]];
 		}
-		struct svm_model *submodel = svm_train(&subprob,param);
-		if(param->probability && 
-		   (param->svm_type == C_SVC || param->svm_type == NU_SVC))
+	}
+	free(row_inst);
+	bool collapsed = n < l;
+
+	double Cp, Cn;
+	nsv_weights(param,label_p,label_n,&Cp,&Cn);
+	if(alpha0)
+	{
+		for(i=0;i<l;i++)
 		{
-			double *prob_estimates=Malloc(double,svm_get_nr_class(submodel));
-			for(j=begin;j<end;j++)
-				target[perm[j]] = svm_predict_probability(submodel,prob->x[perm[j]],prob_estimates);
-			free(prob_estimates);
+			int j = ws->inst[i];
+			alpha[j] += min(max(alpha0[i],0.0),y[j] > 0? Cp : Cn);
 		}
-		else
-			for(j=begin;j<end;j++)
-				target[perm[j]] = svm_predict(submodel,prob->x[perm[j]]);
-		svm_free_and_destroy_model(&submodel);
-		free(subprob.x);
-		free(subprob.y);
-	}		
-	free(fold_start);
-	free(perm);
-}
+		balance_alpha(n,y,alpha);
+	}
 
+	Solver::SolutionInfo si;
+	Solver s(ws);
+	s.weight = collapsed? ws->weight : NULL;
+	s.iter_limit = param->max_iter;
+	KernelMatrixQ Q(n,K,l_K,inst_row,y,*param);
+	free(inst_row);
+	s.Solve(n, Q, ws->minus_ones, y, alpha, Cp, Cn, param->eps, &si, param->shrinking);
+	ws->info.iterations = si.iter;
+	ws->info.kkt_gap = si.gap;
+	ws->info.stopped = si.stopped;
+	ws->info.instances = n;
+	ws->l = l;
+
+	int nSV = 0;
+	for(i=0;i<l;i++)
+		if(alpha[ws->inst[i]] > 0)
+			++nSV;
+	info("nSV = %d\n",nSV);
+	return nSV;
+}
 
 int svm_get_svm_type(const svm_model *model)
 {
@@ -3061,6 +6169,40 @@ const char *svm_check_parameter(const svm_problem *prob, const svm_parameter *pa
 	if(param->cache_size <= 0)
 		return "cache_size <= 0";
 
+	if(param->cache_type != CACHE_FLOAT &&
+	   param->cache_type != CACHE_FP16 &&
+	   param->cache_type != CACHE_BF16)
+		return "unknown cache type";
+
+	if(param->cache_policy != CACHE_LRU &&
+	   param->cache_policy != CACHE_LFU &&
+	   param->cache_policy != CACHE_SV)
+		return "unknown cache policy";
+
+	if(param->kernel_drop < 0 || param->kernel_drop >= 1)
+		return "kernel_drop not in [0,1)";
+
+	if(param->kernel_drop > 0 && param->cache_type != CACHE_FLOAT)
+		return "kernel_drop needs a float cache";
+
+	if(param->dc_clusters < 0)
+		return "dc_clusters < 0";
+
+	if(param->sv_screen < 0)
+		return "sv_screen < 0";
+
+	if(param->max_iter < 0)
+		return "max_iter < 0";
+
+	if(param->max_time < 0)
+		return "max_time < 0";
+
+	if(param->coreset < 0)
+		return "coreset < 0";
+
+	if(param->sv_screen > 0 && param->dc_clusters > 1)
+		return "sv_screen and dc_clusters cannot be combined";
+
 	if(param->eps <= 0)
 		return "eps <= 0";
 
@@ -24,6 +24,9 @@ struct svm_problem
 
 enum { C_SVC, NU_SVC, ONE_CLASS, EPSILON_SVR, NU_SVR };	/* svm_type */
 enum { LINEAR, POLY, RBF, SIGMOID, PRECOMPUTED }; /* kernel_type */
+enum { CACHE_FLOAT, CACHE_FP16, CACHE_BF16 };	/* cache_type */
+enum { CACHE_LRU, CACHE_LFU, CACHE_SV };	/* cache_policy */
+enum { COLLAPSE_OFF, COLLAPSE_FRAMES, COLLAPSE_COPIES };	/* collapse_duplicates */
 
 struct svm_parameter
 {
@@ -44,6 +47,17 @@ struct svm_parameter
 	double p;	/* for EPSILON_SVR */
 	int shrinking;	/* use the shrinking heuristics */
 	int probability; /* do probability estimates */
+	int cache_type;	/* kernel cache storage, for C_SVC */
+	int cache_policy;	/* kernel cache replacement, for C_SVC */
+	int mixed_precision;	/* float solve before the double one, for svm_train_nsv */
+	double kernel_drop;	/* cache only entries with |Q| >= kernel_drop, 0 = all, for C_SVC */
+	int dc_clusters;	/* solve this many kernel k-means clusters first, 0 = off, for svm_train_nsv */
+	int sv_screen;	/* train the nearest sv_screen frames of the other class first, 0 = off, for svm_train_nsv */
+	int max_iter;	/* stop svm_train_nsv after this many SMO iterations, 0 = libsvm's limit */
+	double max_time;	/* stop svm_train_nsv after this many seconds, 0 = no limit */
+	double deadline;	/* stop svm_train_nsv at this svm_wall_time, 0 = no limit */
+	int collapse_duplicates;	/* train identical frames of a class as one weighted instance (COLLAPSE_*), for svm_train_nsv */
+	int coreset;	/* train this many k-center instances per class instead of the frames, 0 = off, for svm_train_nsv */
 };
 
 //
@@ -72,7 +86,43 @@ struct svm_model
 };
 
 struct svm_model *svm_train(const struct svm_problem *prob, const struct svm_parameter *param);
+
+struct svm_workspace;	/* reusable training buffers, see svm_train_nsv */
+struct svm_workspace *svm_workspace_create(void);
+void svm_workspace_destroy(struct svm_workspace *ws);
+int svm_train_nsv(const struct svm_problem *prob, const struct svm_parameter *param, struct svm_workspace *ws, int *sv_indices);
+int svm_train_nsv_from(const struct svm_problem *prob, const struct svm_parameter *param, struct svm_workspace *ws, const double *alpha0, int *sv_indices);
+int svm_get_alpha(const struct svm_workspace *ws, double *alpha);
+int svm_train_nsv_rff(const struct svm_problem *prob, const struct svm_parameter *param, int ndim, unsigned int seed);
+int svm_train_nsv_linear(const struct svm_problem *prob, const struct svm_parameter *param);
+float *svm_kernel_matrix(const struct svm_problem *prob, const struct svm_parameter *param);
+void svm_kernel_matrix_from(const struct svm_problem *prob, const struct svm_parameter *param, const float *K_old, int l_old, const int *old_index, float *K);
+int svm_train_nsv_kernel(const struct svm_problem *prob, const struct svm_parameter *param, const float *K, const double *alpha0, struct svm_workspace *ws);
+int svm_train_nsv_kernel_rows(const struct svm_problem *prob, const struct svm_parameter *param, const float *K, int l_K, const int *rows, const double *alpha0, struct svm_workspace *ws);
+
+struct svm_solve_info	/* statistics of the last svm_train_nsv */
+{
+	long cache_hits;	/* kernel columns served from the cache */
+	long cache_misses;	/* kernel columns (partly) computed */
+	long cache_evictions;	/* columns dropped to make room */
+	double dropped_mass;	/* largest sum of dropped |Q| in one column, see kernel_drop */
+	double kept_fraction;	/* fraction of computed entries kept, see kernel_drop */
+	long iterations;	/* SMO iterations, over all solves of the problem */
+	double kkt_gap;	/* violation of the optimality conditions at the end, below eps unless stopped */
+	int stopped;	/* 1 if max_iter, max_time or deadline stopped the solver before eps */
+	int instances;	/* rows trained, fewer than the frames with collapse_duplicates or coreset */
+	double coreset_radius;	/* largest distance from a frame to its coreset center */
+};
+void svm_get_solve_info(const struct svm_workspace *ws, struct svm_solve_info *info);
+double svm_wall_time(void);
 void svm_cross_validation(const struct svm_problem *prob, const struct svm_parameter *param, int nr_fold, double *target);
+void svm_sweep_nsv(const struct svm_problem *prob, const struct svm_parameter *param, int ngamma, const double *gamma, int nC, const double *C, const float *d2, struct svm_workspace *ws, int *nSV);
+
+struct svm_frame_block;	/* features of several problems over the same frames */
+struct svm_frame_block *svm_frame_block_create(const struct svm_problem *probs, int nprobs);
+void svm_frame_block_destroy(struct svm_frame_block *block);
+void svm_frame_block_sq_dist(const struct svm_frame_block *block, int i0, int i1, float **d2);
+void svm_frame_block_mirror(const struct svm_frame_block *block, int i0, int i1, float **d2);
 
 int svm_save_model(const char *model_file_name, const struct svm_model *model);
 struct svm_model *svm_load_model(const char *model_file_name);
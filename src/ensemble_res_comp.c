@@ -21,10 +21,32 @@
 #include <omp.h>
 #endif
 
-static void free_svm_model(struct svm_model *model);
-
-
-static void res_pdb(eta_dat_t *eta_dat, t_atoms *atoms) {
+#define D2_ROWS 32 // distance matrix rows built per task in a (gamma, C) sweep
+#define WARM_CHAIN 8 // consecutive residues trained by one thread with warm starts
+#define MOMENT_RIDGE 1e-4 // added to covariance diagonals (A^2), keeps rigid coordinates invertible
+#define BOOT_SEED 0x9E3779B97F4A7C15ULL // bootstrap resamples and permutations are the same in every run
+#define CORESET_TOL 0.05 // coreset sensitivity above which -kcheck warns
+#define ESS_MIN_FRAMES 16 // autocorrelation is measured at lags up to a quarter of the frames, if at least this many
+
+static void parse_grid(const char *list, real def, int *n, real **vals);
+static void check_cache_eta(eta_res_dat_t *eta_dat, struct svm_problem *probs, const struct svm_parameter *param, int nframes);
+static void check_coreset_eta(eta_res_dat_t *eta_dat, struct svm_problem *probs, const struct svm_parameter *param, int nframes);
+static void check_mixed_eta(eta_res_dat_t *eta_dat, struct svm_problem *probs, const struct svm_parameter *param, int nframes);
+static void check_warm_eta(eta_res_dat_t *eta_dat, struct svm_problem *probs, const struct svm_parameter *param, int nframes);
+static real recheck_eta(eta_res_dat_t *eta_dat, struct svm_problem *probs, const struct svm_parameter *check_param, int nframes, const char *what, int *ncheck, int *ndiff);
+static void report_kernel_drop(const eta_res_dat_t *eta_dat, const struct svm_parameter *param);
+static void report_budgets(const eta_res_dat_t *eta_dat, const struct svm_parameter *param);
+static gmx_bool res_screened(const eta_res_dat_t *eta_dat, int res);
+static void train_screened_probs(eta_res_dat_t *eta_dat, struct svm_problem *probs, const struct svm_parameter *param, int nframes, int *nsv, float **alphas);
+static void check_moment_eta(eta_res_dat_t *eta_dat, struct svm_problem *probs, const struct svm_parameter *param, int nframes);
+static void check_linear_eta(eta_res_dat_t *eta_dat, struct svm_problem *probs, const struct svm_parameter *param, int nframes, const int *nsv);
+static void train_res_probs(eta_res_dat_t *eta_dat, struct svm_problem *sub, int nsub, const int *sub_res, const struct svm_parameter *param, int nframes, int *nsv, struct svm_solve_info *info, float **alphas);
+static void boot_eta(eta_res_dat_t *eta_dat, struct svm_problem *probs, const struct svm_parameter *param, int nframes, float **alphas);
+static void perm_eta(eta_res_dat_t *eta_dat, struct svm_problem *probs, const struct svm_parameter *param, int nframes);
+static int ess_stride(eta_res_dat_t *eta_dat, rvec **x1, rvec **x2, int nframes, const t_atoms *atoms);
+
+
+static void res_pdb(eta_res_dat_t *eta_dat, t_atoms *atoms) {
     char title[256];
     rvec *x;
 
@@ -53,7 +75,7 @@ static void res_pdb(eta_dat_t *eta_dat, t_atoms *atoms) {
 }
 
 // Try res_tpx for gro and tpr instead of this.
-static void res_tps(eta_dat_t *eta_dat, t_atoms *atoms) {
+static void res_tps(eta_res_dat_t *eta_dat, t_atoms *atoms) {
     char title[256];
     t_topology top;
     rvec *x = NULL;
@@ -78,7 +100,7 @@ static void res_tps(eta_dat_t *eta_dat, t_atoms *atoms) {
 }
 
 // TODO: Does this work for gro files generated by grompp etc?
-static void res_tpx(eta_dat_t *eta_dat, t_atoms *atoms) {
+static void res_tpx(eta_res_dat_t *eta_dat, t_atoms *atoms) {
     t_inputrec ir;
     gmx_mtop_t mtop;
     matrix box;
@@ -91,17 +113,1083 @@ static void res_tpx(eta_dat_t *eta_dat, t_atoms *atoms) {
 }
 
 
+void init_svm_param(struct svm_parameter *param, real gamma, real c) {
+    param->svm_type = C_SVC;
+    param->kernel_type = RBF;
+    param->degree = 3;
+    param->gamma = gamma;
+    param->coef0 = 0.0;
+    param->cache_size = 100.0;
+    param->eps = 0.001;
+    param->C = c;
+    param->nr_weight = 0;
+    param->nu = 0.5;
+    param->p = 0.1;
+    param->shrinking = 1;
+    param->probability = 0;
+    param->cache_type = CACHE_FLOAT;
+    param->cache_policy = CACHE_LRU;
+    param->mixed_precision = 0;
+    param->kernel_drop = 0;
+    param->dc_clusters = 0;
+    param->sv_screen = 0;
+    param->max_iter = 0;
+    param->max_time = 0;
+    param->deadline = 0;
+    param->collapse_duplicates = 0;
+    param->coreset = 0;
+}
+
+// Parses a comma-separated list of values such as "0.1,0.4,1".
+// A NULL list gives the single value def.
+static void parse_grid(const char *list, real def, int *n, real **vals) {
+    const char *s;
+    char *end;
+
+    *n = 0;
+    if (list == NULL) {
+        snew(*vals, 1);
+        (*vals)[(*n)++] = def;
+        return;
+    }
+    snew(*vals, strlen(list) / 2 + 1);
+    for (s = list; *s != '\0'; s = (*end == ',') ? end + 1 : end) {
+        double v = strtod(s, &end);
+        if (end == s || v <= 0) {
+            gk_log_fatal(FARGS, "Invalid value list '%s'. Expected positive comma-separated numbers.\n", list);
+        }
+        (*vals)[(*n)++] = v;
+    }
+    if (*n == 0) {
+        gk_log_fatal(FARGS, "Empty value list '%s'.\n", list);
+    }
+}
+
+// Orders residue indices by the number of features of their problems.
+static const struct svm_problem *sort_probs;
+static int prob_dim(const struct svm_problem *prob) {
+    int d = 0;
+    while (prob->x[0][d].index != -1) {
+        ++d;
+    }
+    return d;
+}
+static int cmp_prob_dim(const void *a, const void *b) {
+    return prob_dim(&sort_probs[*(const int *)a]) - prob_dim(&sort_probs[*(const int *)b]);
+}
+
+// Orders problem indices by their number of support vectors, so by decreasing eta.
+static const int *sort_nsv;
+static int cmp_nsv(const void *a, const void *b) {
+    return sort_nsv[*(const int *)a] - sort_nsv[*(const int *)b];
+}
+
+// Re-trains an evenly spaced sample of ncheck residues with a float kernel cache
+// and reports how far their eta values moved with the half precision cache.
+static void check_cache_eta(eta_res_dat_t *eta_dat,
+                            struct svm_problem *probs,
+                            const struct svm_parameter *param,
+                            int nframes) {
+    struct svm_parameter float_param = *param;
+    int ncheck, ndiff;
+    real max_diff;
+
+    float_param.cache_type = CACHE_FLOAT;
+    max_diff = recheck_eta(eta_dat, probs, &float_param, nframes, "the half precision kernel cache",
+        &ncheck, &ndiff);
+    if (ncheck == 0) {
+        return;
+    }
+    gk_print_log("%d of %d checked residues deviate from the float cache result, max |delta eta| = %f\n",
+        ndiff, ncheck, max_diff);
+    if (ndiff > 0) {
+        gk_print_log("WARNING: half precision kernel cache changes eta. Consider -kcache float.\n");
+    }
+}
+
+// Re-trains an evenly spaced sample of ncheck residues in double precision only and
+// reports how far their eta values moved with the float solve. Both solutions meet
+// the tolerance, but they can stop at different points within it.
+static void check_mixed_eta(eta_res_dat_t *eta_dat,
+                            struct svm_problem *probs,
+                            const struct svm_parameter *param,
+                            int nframes) {
+    struct svm_parameter double_param = *param;
+    int ncheck, ndiff;
+    real max_diff;
+
+    double_param.mixed_precision = 0;
+    max_diff = recheck_eta(eta_dat, probs, &double_param, nframes, "mixed precision training",
+        &ncheck, &ndiff);
+    if (ncheck == 0) {
+        return;
+    }
+    gk_print_log("%d of %d checked residues deviate from the double precision result, max |delta eta| = %f\n",
+        ndiff, ncheck, max_diff);
+}
+
+// Re-trains an evenly spaced sample of ncheck residues that started warm, i.e. that
+// were not first in their chain of WARM_CHAIN trained residues, from zero and reports
+// how far their eta values moved with the warm start.
+static void check_warm_eta(eta_res_dat_t *eta_dat,
+                           struct svm_problem *probs,
+                           const struct svm_parameter *param,
+                           int nframes) {
+    int ncheck, nwarm = 0, ntrained = 0, ndiff = 0;
+    real max_diff = 0;
+    struct svm_problem *sample;
+    int *nsv, *warm;
+    int i;
+
+    snew(warm, eta_dat->nres);
+    for (i = 0; i < eta_dat->nres; ++i) {
+        if (!res_screened(eta_dat, i) && ntrained++ % WARM_CHAIN != 0) {
+            warm[nwarm++] = i;
+        }
+    }
+    ncheck = eta_dat->ncheck < nwarm ? eta_dat->ncheck : nwarm;
+    if (ncheck == 0) {
+        sfree(warm);
+        return;
+    }
+
+    gk_print_log("Checking warm starts on %d of %d residues...\n", ncheck, nwarm);
+
+    snew(sample, ncheck);
+    snew(nsv, ncheck);
+    for (i = 0; i < ncheck; ++i) {
+        sample[i] = probs[warm[i * nwarm / ncheck]];
+    }
+    train_svm_probs(sample, ncheck, param, eta_dat->nthreads, nsv, NULL, FALSE, NULL);
+
+    for (i = 0; i < ncheck; ++i) {
+        int res = warm[i * nwarm / ncheck];
+        real eta = 1.0 - nsv[i] / (2.0 * (real)nframes);
+        real diff = fabs(eta_dat->eta[res] - eta);
+        gk_print_log("Residue %d%s: eta %f, from zero %f\n", eta_dat->res_IDs[res], eta_dat->res_names[res],
+            eta_dat->eta[res], eta);
+        if (diff > 0) {
+            ++ndiff;
+        }
+        if (diff > max_diff) {
+            max_diff = diff;
+        }
+    }
+    gk_print_log("%d of %d checked residues deviate from training from zero, max |delta eta| = %f\n",
+        ndiff, ncheck, max_diff);
+
+    sfree(sample);
+    sfree(nsv);
+    sfree(warm);
+}
+
+// Re-trains ncheck residues with all frames and reports how far their eta
+// values moved with the coreset, as an estimate of its effect on the rest.
+static void check_coreset_eta(eta_res_dat_t *eta_dat,
+                              struct svm_problem *probs,
+                              const struct svm_parameter *param,
+                              int nframes) {
+    struct svm_parameter full_param = *param;
+    int ncheck, ndiff;
+    real max_diff;
+
+    full_param.coreset = 0;
+    max_diff = recheck_eta(eta_dat, probs, &full_param, nframes, "the coreset against all frames",
+        &ncheck, &ndiff);
+    if (ncheck == 0) {
+        return;
+    }
+    gk_print_log("Coreset sensitivity: max |delta eta| = %f over %d residues trained with all frames\n",
+        max_diff, ncheck);
+    if (max_diff > CORESET_TOL) {
+        gk_print_log("WARNING: the coreset moves eta by more than %f. Increase -coreset or train on all frames.\n",
+            CORESET_TOL);
+    }
+}
+
+// Re-trains an evenly spaced sample of ncheck trained residues with check_param,
+// logs their eta both ways, and returns the largest change. The number of
+// residues checked and of those whose eta changed are stored in *ncheck and *ndiff.
+static real recheck_eta(eta_res_dat_t *eta_dat,
+                        struct svm_problem *probs,
+                        const struct svm_parameter *check_param,
+                        int nframes,
+                        const char *what,
+                        int *ncheck_out,
+                        int *ndiff) {
+    int ncheck, nexact = 0;
+    real max_diff = 0;
+    struct svm_problem *sample;
+    int *nsv, *exact;
+    int i;
+
+    *ncheck_out = *ndiff = 0;
+    // residues left at a pre-screen eta were not trained
+    snew(exact, eta_dat->nres);
+    for (i = 0; i < eta_dat->nres; ++i) {
+        if (!res_screened(eta_dat, i)) {
+            exact[nexact++] = i;
+        }
+    }
+    ncheck = eta_dat->ncheck < nexact ? eta_dat->ncheck : nexact;
+    if (ncheck == 0) {
+        sfree(exact);
+        return 0;
+    }
+
+    gk_print_log("Checking %s on %d residues...\n", what, ncheck);
+
+    snew(sample, ncheck);
+    snew(nsv, ncheck);
+    for (i = 0; i < ncheck; ++i) {
+        sample[i] = probs[exact[i * nexact / ncheck]];
+    }
+    train_svm_probs(sample, ncheck, check_param, eta_dat->nthreads, nsv, NULL, FALSE, NULL);
+
+    for (i = 0; i < ncheck; ++i) {
+        int res = exact[i * nexact / ncheck];
+        real eta = 1.0 - nsv[i] / (2.0 * (real)nframes);
+        real diff = fabs(eta_dat->eta[res] - eta);
+        gk_print_log("Residue %d%s: eta %f, checked %f\n", eta_dat->res_IDs[res], eta_dat->res_names[res],
+            eta_dat->eta[res], eta);
+        if (diff > 0) {
+            ++*ndiff;
+        }
+        if (diff > max_diff) {
+            max_diff = diff;
+        }
+    }
+    *ncheck_out = ncheck;
+
+    sfree(sample);
+    sfree(nsv);
+    sfree(exact);
+    return max_diff;
+}
+
+// Reports how much of the kernel matrix was dropped by param->kernel_drop.
+// Dropping entries of total magnitude m from a column moves each gradient
+// entry by at most C * m, so a largest dropped mass well below eps times
+// 1/C leaves the support vectors, and so eta, unchanged.
+static void report_kernel_drop(const eta_res_dat_t *eta_dat, const struct svm_parameter *param) {
+    double kept = 0, max_mass = 0;
+    int max_res = 0, ntrained = 0;
+    int i;
+
+    for (i = 0; i < eta_dat->nres; ++i) {
+        if (res_screened(eta_dat, i)) {
+            continue;
+        }
+        ++ntrained;
+        kept += eta_dat->res_info[i].kept_fraction;
+        if (eta_dat->res_info[i].dropped_mass > max_mass) {
+            max_mass = eta_dat->res_info[i].dropped_mass;
+            max_res = i;
+        }
+    }
+    gk_print_log("Kernel entries below %g kept: %f on average per residue\n",
+        param->kernel_drop, ntrained > 0 ? kept / ntrained : 1.0);
+    gk_print_log("Largest dropped kernel mass in a column: %g (residue %d%s), gradient error <= %g\n",
+        max_mass, eta_dat->res_IDs[max_res], eta_dat->res_names[max_res], param->C * max_mass);
+    if (param->C * max_mass > param->eps) {
+        gk_print_log("WARNING: dropped kernel entries can exceed the solver tolerance. Consider a smaller -kdrop.\n");
+    }
+}
+
+// Reports the residues whose training was stopped by an iteration or time budget.
+static void report_budgets(const eta_res_dat_t *eta_dat, const struct svm_parameter *param) {
+    double max_gap = 0;
+    int nstopped = 0;
+    int i;
+
+    for (i = 0; i < eta_dat->nres; ++i) {
+        if (eta_dat->res_info[i].stopped) {
+            ++nstopped;
+            if (eta_dat->res_info[i].kkt_gap > max_gap) {
+                max_gap = eta_dat->res_info[i].kkt_gap;
+            }
+        }
+    }
+    gk_print_log("%d of %d residues stopped by the iteration or time budget, largest KKT gap %g (tolerance %g)\n",
+        nstopped, eta_dat->nres, max_gap, param->eps);
+    if (nstopped > 0) {
+        gk_print_log("WARNING: eta of residues with CONVERGED = 0 in %s is not final.\n",
+            eta_dat->fnames[eETA_RES]);
+    }
+}
+
+// Whether residue res keeps the eta of a pre-screen instead of being trained.
+static gmx_bool res_screened(const eta_res_dat_t *eta_dat, int res) {
+    return (eta_dat->eta_moment && eta_dat->eta_moment[res] < eta_dat->moment_screen) ||
+           (eta_dat->eta_linear && eta_dat->eta_linear[res]);
+}
+
+// Collects the residues that are not (yet) screened out into sub and returns their number.
+static int gather_probs(const eta_res_dat_t *eta_dat, struct svm_problem *probs,
+                        struct svm_problem *sub, int *sub_res) {
+    int nsub = 0;
+    for (int i = 0; i < eta_dat->nres; ++i) {
+        if (!res_screened(eta_dat, i)) {
+            sub[nsub] = probs[i];
+            sub_res[nsub++] = i;
+        }
+    }
+    return nsub;
+}
+
+// Trains the RBF SVM on the residues that pass the pre-screens. Residues whose
+// moment estimate in eta_dat->eta_moment is below eta_dat->moment_screen are skipped.
+// With eta_dat->linear_screen, the rest are trained with a linear SVM first, and
+// the RBF SVM only on those whose linear eta reaches the threshold. Residues below
+// the threshold are mostly unchanged ones, but a low linear eta does not imply a low
+// RBF eta; check_linear_eta trains a sample of them to check. They keep their linear
+// nsv and are flagged in eta_dat->eta_linear. If alphas is not NULL, the solution of
+// each residue trained with the RBF kernel is stored in alphas[residue].
+static void train_screened_probs(eta_res_dat_t *eta_dat,
+                                 struct svm_problem *probs,
+                                 const struct svm_parameter *param,
+                                 int nframes,
+                                 int *nsv,
+                                 float **alphas) {
+    struct svm_problem *sub;
+    struct svm_solve_info *sub_info = NULL;
+    float **sub_alpha = NULL;
+    int *sub_res, *sub_nsv;
+    int nsub;
+    int i;
+
+    snew(sub, eta_dat->nres);
+    snew(sub_res, eta_dat->nres);
+    snew(sub_nsv, eta_dat->nres);
+    nsub = gather_probs(eta_dat, probs, sub, sub_res);
+    if (eta_dat->eta_moment) {
+        gk_print_log("%d of %d residues have a moment estimate below %f and are not trained\n",
+            eta_dat->nres - nsub, eta_dat->nres, eta_dat->moment_screen);
+    }
+
+    if (eta_dat->linear_screen > 0) {
+        int nlinear = nsub;
+        linear_svm_probs(sub, nsub, param, eta_dat->nthreads, sub_nsv);
+
+        snew(eta_dat->eta_linear, eta_dat->nres);
+        for (i = 0; i < nsub; ++i) {
+            nsv[sub_res[i]] = sub_nsv[i];
+            if (1.0 - sub_nsv[i] / (2.0 * (real)nframes) < eta_dat->linear_screen) {
+                eta_dat->eta_linear[sub_res[i]] = TRUE;
+            }
+        }
+        check_linear_eta(eta_dat, probs, param, nframes, nsv);
+        nsub = gather_probs(eta_dat, probs, sub, sub_res);
+        gk_print_log("%d of %d residues reach linear eta %f and are trained with the RBF kernel\n",
+            nsub, nlinear, eta_dat->linear_screen);
+    }
+
+    if (nsub > 0) {
+        if (eta_dat->res_info) {
+            snew(sub_info, nsub);
+        }
+        if (alphas) {
+            snew(sub_alpha, nsub);
+        }
+        train_res_probs(eta_dat, sub, nsub, sub_res, param, nframes, sub_nsv, sub_info, sub_alpha);
+        for (i = 0; i < nsub; ++i) {
+            nsv[sub_res[i]] = sub_nsv[i];
+            if (sub_info) {
+                eta_dat->res_info[sub_res[i]] = sub_info[i];
+            }
+            if (sub_alpha) {
+                alphas[sub_res[i]] = sub_alpha[i];
+            }
+        }
+        if (sub_info) sfree(sub_info);
+        if (sub_alpha) sfree(sub_alpha);
+    }
+
+    sfree(sub);
+    sfree(sub_res);
+    sfree(sub_nsv);
+}
+
+// Trains the problems in sub, of residues sub_res. With eta_dat->coarse_eps, all of them
+// are first solved to that tolerance, and their provisional eta is saved to
+// fnames[eETA_COARSE] if given. Only residues whose coarse eta reaches eta_dat->refine_eta,
+// or is among the eta_dat->refine_top largest, are then solved to param->eps, starting
+// from their coarse solution. The others keep their coarse nsv.
+// If alphas is not NULL, the final solution of sub[i] is stored in alphas[i].
+static void train_res_probs(eta_res_dat_t *eta_dat,
+                            struct svm_problem *sub,
+                            int nsub,
+                            const int *sub_res,
+                            const struct svm_parameter *param,
+                            int nframes,
+                            int *nsv,
+                            struct svm_solve_info *info,
+                            float **alphas) {
+    struct svm_parameter coarse_param = *param;
+    struct svm_problem *ref;
+    struct svm_solve_info *ref_info = NULL;
+    float **alpha, **ref_alpha;
+    int *order, *ref_nsv, *ref_idx;
+    int nref = 0;
+    int i;
+
+    if (eta_dat->coarse_eps <= 0) {
+        train_svm_probs(sub, nsub, param, eta_dat->nthreads, nsv, info, eta_dat->warm_start, alphas);
+        return;
+    }
+
+    gk_print_log("Coarse training with tolerance %f...\n", eta_dat->coarse_eps);
+    coarse_param.eps = eta_dat->coarse_eps;
+    if (alphas) {
+        alpha = alphas;
+    }
+    else {
+        snew(alpha, nsub);
+    }
+    train_svm_probs(sub, nsub, &coarse_param, eta_dat->nthreads, nsv, info, eta_dat->warm_start, alpha);
+
+    // pick the residues to refine
+    snew(order, nsub);
+    for (i = 0; i < nsub; ++i) {
+        order[i] = i;
+    }
+    sort_nsv = nsv;
+    qsort(order, nsub, sizeof(int), cmp_nsv);
+    snew(eta_dat->eta_refined, eta_dat->nres);
+    for (i = 0; i < nsub; ++i) {
+        if (i < eta_dat->refine_top || 1.0 - nsv[order[i]] / (2.0 * (real)nframes) >= eta_dat->refine_eta) {
+            eta_dat->eta_refined[sub_res[order[i]]] = TRUE;
+        }
+    }
+
+    if (eta_dat->fnames[eETA_COARSE] != NULL) {
+        FILE *f = fopen(eta_dat->fnames[eETA_COARSE], "w");
+
+        if (f) {
+            gk_print_log("Saving provisional residue eta values to %s...\n",
+                eta_dat->fnames[eETA_COARSE]);
+
+            fprintf(f, "# RES\tETA\tREFINE\n");
+            for (i = 0; i < nsub; ++i) {
+                fprintf(f, "%d%s\t%f\t%d\n", eta_dat->res_IDs[sub_res[i]],
+                                           eta_dat->res_names[sub_res[i]],
+                                           1.0 - nsv[i] / (2.0 * (real)nframes),
+                                           eta_dat->eta_refined[sub_res[i]] ? 1 : 0);
+            }
+
+            fclose(f);
+            f = NULL;
+        }
+        else {
+            gk_print_log("Failed to open file %s for saving provisional residue eta values.\n",
+                eta_dat->fnames[eETA_COARSE]);
+        }
+        gk_flush_log();
+    }
+
+    // refine, each residue from its coarse solution
+    snew(ref, nsub);
+    snew(ref_alpha, nsub);
+    snew(ref_nsv, nsub);
+    snew(ref_idx, nsub);
+    for (i = 0; i < nsub; ++i) {
+        if (eta_dat->eta_refined[sub_res[i]]) {
+            ref[nref] = sub[i];
+            ref_alpha[nref] = alpha[i];
+            ref_idx[nref++] = i;
+        }
+    }
+    gk_print_log("Refining %d of %d residues with tolerance %f...\n", nref, nsub, param->eps);
+    if (nref > 0) {
+        if (info) {
+            snew(ref_info, nref);
+        }
+        train_svm_probs(ref, nref, param, eta_dat->nthreads, ref_nsv, ref_info, FALSE, ref_alpha);
+        for (i = 0; i < nref; ++i) {
+            nsv[ref_idx[i]] = ref_nsv[i];
+            if (ref_info) {
+                long coarse_iter = info[ref_idx[i]].iterations;
+                info[ref_idx[i]] = ref_info[i];
+                info[ref_idx[i]].iterations += coarse_iter;
+            }
+        }
+        if (ref_info) sfree(ref_info);
+    }
+
+    if (!alphas) {
+        for (i = 0; i < nsub; ++i) {
+            if (alpha[i]) sfree(alpha[i]);
+        }
+        sfree(alpha);
+    }
+    sfree(order);
+    sfree(ref);
+    sfree(ref_alpha);
+    sfree(ref_nsv);
+    sfree(ref_idx);
+}
+
+static int cmp_real(const void *a, const void *b) {
+    real x = *(const real *)a, y = *(const real *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Retrains the residues trained with the RBF kernel on eta_dat->nboot bootstrap
+// resamples, starting from their solutions in alphas, and stores the 2.5 and 97.5
+// percentiles of their eta in eta_dat->eta_lo and eta_dat->eta_hi.
+static void boot_eta(eta_res_dat_t *eta_dat,
+                     struct svm_problem *probs,
+                     const struct svm_parameter *param,
+                     int nframes,
+                     float **alphas) {
+    int nboot = eta_dat->nboot;
+    struct svm_problem *sub;
+    float **sub_alpha;
+    int *sub_res, *nsv;
+    real *eta;
+    int nsub = 0, i, b;
+
+    snew(sub, eta_dat->nres);
+    snew(sub_alpha, eta_dat->nres);
+    snew(sub_res, eta_dat->nres);
+    for (i = 0; i < eta_dat->nres; ++i) {
+        if (alphas[i]) {
+            sub[nsub] = probs[i];
+            sub_alpha[nsub] = alphas[i];
+            sub_res[nsub++] = i;
+        }
+    }
+    gk_print_log("Training %d residues on %d bootstrap resamples in blocks of %d frames...\n",
+        nsub, nboot, eta_dat->boot_block);
+    gk_flush_log();
+
+    snew(nsv, nsub * nboot);
+    boot_svm_probs(sub, sub_res, nsub, param, nframes, nboot, eta_dat->boot_block, eta_dat->nthreads, sub_alpha, nsv);
+
+    snew(eta_dat->eta_lo, eta_dat->nres);
+    snew(eta_dat->eta_hi, eta_dat->nres);
+    for (i = 0; i < eta_dat->nres; ++i) {
+        eta_dat->eta_lo[i] = eta_dat->eta_hi[i] = -1;
+    }
+    snew(eta, nboot);
+    for (i = 0; i < nsub; ++i) {
+        for (b = 0; b < nboot; ++b) {
+            eta[b] = 1.0 - nsv[i * nboot + b] / (2.0 * (real)nframes);
+        }
+        qsort(eta, nboot, sizeof(real), cmp_real);
+        eta_dat->eta_lo[sub_res[i]] = eta[(int)(0.025 * (nboot - 1) + 0.5)];
+        eta_dat->eta_hi[sub_res[i]] = eta[(int)(0.975 * (nboot - 1) + 0.5)];
+    }
+
+    sfree(eta);
+    sfree(nsv);
+    sfree(sub);
+    sfree(sub_alpha);
+    sfree(sub_res);
+}
+
+// Retrains the residues trained with the RBF kernel with eta_dat->nperm permutations
+// of their labels, and stores the fraction of permutations (counting the observed
+// labels as one) whose eta reaches the observed one in eta_dat->eta_pvalue.
+// The permutations and the observed labels are solved the same way, to param->eps
+// on all frames with a plain float kernel cache (see svm_train_nsv_kernel), so the
+// options of param that svm_train_nsv_kernel ignores are cleared for both.
+static void perm_eta(eta_res_dat_t *eta_dat,
+                     struct svm_problem *probs,
+                     const struct svm_parameter *param,
+                     int nframes) {
+    struct svm_parameter perm_param = *param;
+    int nperm = eta_dat->nperm;
+    struct svm_problem *sub;
+    int *sub_res, *nsv, *nsv_obs;
+    int nsub, i, k;
+
+    perm_param.max_iter = 0;
+    perm_param.max_time = 0;
+    perm_param.deadline = 0;
+    perm_param.coreset = 0;
+    perm_param.cache_type = CACHE_FLOAT;
+    perm_param.kernel_drop = 0;
+    perm_param.dc_clusters = 0;
+    perm_param.sv_screen = 0;
+    perm_param.mixed_precision = 0;
+    perm_param.collapse_duplicates = COLLAPSE_OFF;
+
+    snew(sub, eta_dat->nres);
+    snew(sub_res, eta_dat->nres);
+    nsub = gather_probs(eta_dat, probs, sub, sub_res);
+
+    gk_print_log("Training %d residues with %d label permutations in blocks of %d frames...\n",
+        nsub, nperm, eta_dat->boot_block);
+    gk_flush_log();
+
+    snew(nsv, nsub * nperm);
+    snew(nsv_obs, nsub);
+    perm_svm_probs(sub, sub_res, nsub, &perm_param, nframes, nperm, eta_dat->boot_block, eta_dat->nthreads,
+        nsv, nsv_obs);
+
+    snew(eta_dat->eta_pvalue, eta_dat->nres);
+    for (i = 0; i < eta_dat->nres; ++i) {
+        eta_dat->eta_pvalue[i] = -1;
+    }
+    for (i = 0; i < nsub; ++i) {
+        int nreach = 1;
+        for (k = 0; k < nperm; ++k) {
+            if (nsv[i * nperm + k] <= nsv_obs[i]) {
+                ++nreach;
+            }
+        }
+        eta_dat->eta_pvalue[sub_res[i]] = nreach / (real)(nperm + 1);
+    }
+
+    sfree(nsv);
+    sfree(nsv_obs);
+    sfree(sub);
+    sfree(sub_res);
+}
+
+// Trains an evenly spaced sample of ncheck residues that the moment estimate would skip,
+// exactly and on all frames. If any of them has an eta above its estimate, the estimate
+// is too low for these ensembles, and eta_dat->moment_screen is cleared so that every
+// residue is trained.
+static void check_moment_eta(eta_res_dat_t *eta_dat,
+                             struct svm_problem *probs,
+                             const struct svm_parameter *param,
+                             int nframes) {
+    struct svm_parameter check_param = *param;
+    int ncheck, nskip = 0, nover = 0;
+    struct svm_problem *sample;
+    int *nsv, *skipped;
+    int i;
+
+    check_param.max_iter = 0;
+    check_param.max_time = 0;
+    check_param.deadline = 0;
+    check_param.coreset = 0;
+
+    snew(skipped, eta_dat->nres);
+    for (i = 0; i < eta_dat->nres; ++i) {
+        if (eta_dat->eta_moment[i] < eta_dat->moment_screen) {
+            skipped[nskip++] = i;
+        }
+    }
+    ncheck = eta_dat->ncheck < nskip ? eta_dat->ncheck : nskip;
+    if (ncheck == 0) {
+        sfree(skipped);
+        return;
+    }
+
+    gk_print_log("Checking the moment estimate on %d of %d residues below %f...\n",
+        ncheck, nskip, eta_dat->moment_screen);
+
+    snew(sample, ncheck);
+    snew(nsv, ncheck);
+    for (i = 0; i < ncheck; ++i) {
+        sample[i] = probs[skipped[i * nskip / ncheck]];
+    }
+    train_svm_probs(sample, ncheck, &check_param, eta_dat->nthreads, nsv, NULL, FALSE, NULL);
+
+    for (i = 0; i < ncheck; ++i) {
+        int res = skipped[i * nskip / ncheck];
+        real eta = 1.0 - nsv[i] / (2.0 * (real)nframes);
+        gk_print_log("Residue %d%s: estimate %f, eta %f\n", eta_dat->res_IDs[res], eta_dat->res_names[res],
+            eta_dat->eta_moment[res], eta);
+        if (eta > eta_dat->eta_moment[res]) {
+            ++nover;
+        }
+    }
+    if (nover > 0) {
+        gk_print_log("WARNING: %d of %d checked residues exceed their moment estimate. Training all residues.\n",
+            nover, ncheck);
+        eta_dat->moment_screen = 0;
+    }
+
+    sfree(sample);
+    sfree(nsv);
+    sfree(skipped);
+}
+
+// Trains an evenly spaced sample of ncheck residues that the linear pre-screen left out
+// with the RBF kernel, exactly and on all frames; nsv holds their linear nsv. If any of
+// them reaches eta_dat->linear_screen, the linear SVM misses separation that the RBF
+// kernel finds, and eta_dat->eta_linear is cleared so that every residue is trained.
+static void check_linear_eta(eta_res_dat_t *eta_dat,
+                             struct svm_problem *probs,
+                             const struct svm_parameter *param,
+                             int nframes,
+                             const int *nsv) {
+    struct svm_parameter check_param = *param;
+    int ncheck, nskip = 0, nover = 0;
+    struct svm_problem *sample;
+    int *rbf_nsv, *skipped;
+    int i;
+
+    check_param.max_iter = 0;
+    check_param.max_time = 0;
+    check_param.deadline = 0;
+    check_param.coreset = 0;
+
+    snew(skipped, eta_dat->nres);
+    for (i = 0; i < eta_dat->nres; ++i) {
+        if (eta_dat->eta_linear[i]) {
+            skipped[nskip++] = i;
+        }
+    }
+    ncheck = eta_dat->ncheck < nskip ? eta_dat->ncheck : nskip;
+    if (ncheck == 0) {
+        sfree(skipped);
+        return;
+    }
+
+    gk_print_log("Checking the linear pre-screen on %d of %d residues below %f...\n",
+        ncheck, nskip, eta_dat->linear_screen);
+
+    snew(sample, ncheck);
+    snew(rbf_nsv, ncheck);
+    for (i = 0; i < ncheck; ++i) {
+        sample[i] = probs[skipped[i * nskip / ncheck]];
+    }
+    train_svm_probs(sample, ncheck, &check_param, eta_dat->nthreads, rbf_nsv, NULL, FALSE, NULL);
+
+    for (i = 0; i < ncheck; ++i) {
+        int res = skipped[i * nskip / ncheck];
+        real eta = 1.0 - rbf_nsv[i] / (2.0 * (real)nframes);
+        gk_print_log("Residue %d%s: linear eta %f, eta %f\n", eta_dat->res_IDs[res], eta_dat->res_names[res],
+            1.0 - nsv[res] / (2.0 * (real)nframes), eta);
+        if (eta >= eta_dat->linear_screen) {
+            ++nover;
+        }
+    }
+    if (nover > 0) {
+        gk_print_log("WARNING: %d of %d checked residues reach %f with the RBF kernel. Training all residues.\n",
+            nover, ncheck, eta_dat->linear_screen);
+        for (i = 0; i < eta_dat->nres; ++i) {
+            eta_dat->eta_linear[i] = FALSE;
+        }
+    }
+
+    sfree(sample);
+    sfree(rbf_nsv);
+    sfree(skipped);
+}
+
+// Cholesky factorization of the symmetric positive definite d x d matrix a in place,
+// reading and writing its lower triangle. Returns FALSE if a is not positive definite.
+static gmx_bool cholesky(double *a, int d, double *logdet) {
+    int i, j, k;
+
+    *logdet = 0;
+    for (j = 0; j < d; ++j) {
+        double s = a[j * d + j];
+        for (k = 0; k < j; ++k) {
+            s -= a[j * d + k] * a[j * d + k];
+        }
+        if (s <= 0) {
+            return FALSE;
+        }
+        a[j * d + j] = sqrt(s);
+        *logdet += 2 * log(a[j * d + j]);
+        for (i = j + 1; i < d; ++i) {
+            double t = a[i * d + j];
+            for (k = 0; k < j; ++k) {
+                t -= a[i * d + k] * a[j * d + k];
+            }
+            a[i * d + j] = t / a[j * d + j];
+        }
+    }
+    return TRUE;
+}
+
+// sqrt(1 - BC^2) for the Bhattacharyya coefficient BC of Gaussians fitted to the two ensembles of prob.
+static real moment_estimate(const struct svm_problem *prob) {
+    int d = prob_dim(prob);
+    int n[2] = {0, 0};
+    double *mean, *cov, *diff, *pooled;
+    double logdet[3], maha = 0, bc;
+    const struct svm_node *x0 = prob->x[0];
+    int i, j, k, c;
+
+    snew(mean, 2 * d);
+    snew(cov, 3 * d * d);
+    snew(diff, d);
+    pooled = cov + 2 * d * d;
+
+    // one pass over the frames, relative to the first frame for a stable covariance
+    for (i = 0; i < prob->l; ++i) {
+        double *m, *s;
+        c = prob->y[i] == prob->y[0] ? 0 : 1;
+        m = mean + c * d;
+        s = cov + c * d * d;
+        ++n[c];
+        for (j = 0; j < d; ++j) {
+            double xj = prob->x[i][j].value - x0[j].value;
+            m[j] += xj;
+            for (k = 0; k <= j; ++k) {
+                s[j * d + k] += xj * (prob->x[i][k].value - x0[k].value);
+            }
+        }
+    }
+    if (n[1] == 0) {
+        sfree(mean);
+        sfree(cov);
+        sfree(diff);
+        return 0;
+    }
+
+    for (c = 0; c < 2; ++c) {
+        double *m = mean + c * d, *s = cov + c * d * d;
+        for (j = 0; j < d; ++j) {
+            m[j] /= n[c];
+        }
+        for (j = 0; j < d; ++j) {
+            for (k = 0; k <= j; ++k) {
+                s[j * d + k] = s[j * d + k] / n[c] - m[j] * m[k];
+            }
+            s[j * d + j] += MOMENT_RIDGE;
+        }
+    }
+    for (j = 0; j < d; ++j) {
+        diff[j] = mean[d + j] - mean[j];
+        for (k = 0; k <= j; ++k) {
+            pooled[j * d + k] = 0.5 * (cov[j * d + k] + cov[d * d + j * d + k]);
+        }
+    }
+    for (c = 0; c < 3; ++c) {
+        if (!cholesky(cov + c * d * d, d, &logdet[c])) {
+            // numerically singular despite the ridge, so no estimate
+            sfree(mean);
+            sfree(cov);
+            sfree(diff);
+            return 1;
+        }
+    }
+
+    // Mahalanobis distance of the means under the pooled covariance
+    for (j = 0; j < d; ++j) {
+        double t = diff[j];
+        for (k = 0; k < j; ++k) {
+            t -= pooled[j * d + k] * diff[k];
+        }
+        diff[j] = t / pooled[j * d + j];
+        maha += diff[j] * diff[j];
+    }
+    bc = exp(-(maha / 8 + 0.5 * (logdet[2] - 0.5 * (logdet[0] + logdet[1]))));
+
+    sfree(mean);
+    sfree(cov);
+    sfree(diff);
+    return sqrt(1 - bc * bc);
+}
+
+// Autocorrelation of the coordinates of each residue of trajectory x at lags 1, 2, 4, ...,
+// as the trace of the autocovariance matrix over the trace of the covariance matrix.
+// rho[r * nlags + k] is the autocorrelation of residue r at lag 2^k.
+static void res_autocorr(rvec **x, int nframes, const t_atoms *atoms, int nlags, double *rho) {
+    int nres = atoms->nres;
+    double *cov; // per atom, the variance and then the autocovariance at each lag
+    int a, r, k;
+
+    snew(cov, atoms->nr * (nlags + 1));
+#pragma omp parallel for schedule(dynamic) private(a,k)
+    for (a = 0; a < atoms->nr; ++a) {
+        double *c = cov + a * (nlags + 1);
+        for (int d = 0; d < 3; ++d) {
+            double mean = 0;
+            int f;
+            for (f = 0; f < nframes; ++f) {
+                mean += x[f][a][d];
+            }
+            mean /= nframes;
+            for (f = 0; f < nframes; ++f) {
+                double dx = x[f][a][d] - mean;
+                c[0] += dx * dx;
+            }
+            for (k = 0; k < nlags; ++k) {
+                int lag = 1 << k;
+                double s = 0;
+                for (f = 0; f + lag < nframes; ++f) {
+                    s += (x[f][a][d] - mean) * (x[f + lag][a][d] - mean);
+                }
+                c[k + 1] += s * nframes / (nframes - lag);
+            }
+        }
+    }
+
+    double *var;
+    snew(var, nres);
+    for (r = 0; r < nres * nlags; ++r) {
+        rho[r] = 0;
+    }
+    for (a = 0; a < atoms->nr; ++a) {
+        r = atoms->atom[a].resind;
+        var[r] += cov[a * (nlags + 1)];
+        for (k = 0; k < nlags; ++k) {
+            rho[r * nlags + k] += cov[a * (nlags + 1) + k + 1];
+        }
+    }
+    for (r = 0; r < nres; ++r) {
+        for (k = 0; k < nlags; ++k) {
+            rho[r * nlags + k] = var[r] > 0 ? rho[r * nlags + k] / var[r] : 0;
+        }
+    }
+    sfree(var);
+    sfree(cov);
+}
+
+// Decay per frame q of an exponential autocorrelation q^lag fitted at the first
+// lag where the measured autocorrelation rho (at lags 1, 2, 4, ...) falls below 1/2,
+// or at the last lag if it never does.
+static double autocorr_decay(const double *rho, int nlags) {
+    int k;
+
+    for (k = 0; k < nlags - 1 && rho[k] >= 0.5; ++k);
+    if (rho[k] <= 0) {
+        return 0;
+    }
+    if (rho[k] >= 1) {
+        return 1;
+    }
+    return pow(rho[k], 1.0 / (1 << k));
+}
+
+// Effective sample size of n frames thinned to every stride-th frame, relative to n,
+// for an autocorrelation q^lag: the thinned frames have an integrated
+// autocorrelation time of (1 + q^stride) / (1 - q^stride).
+static double ess_fraction(double q, int stride) {
+    double qs = pow(q, stride);
+    return (1 - qs) / (stride * (1 + qs));
+}
+
+// Measures the integrated autocorrelation time of each residue in both
+// trajectories and returns the largest stride that keeps ess_keep of the
+// effective sample size of every residue. The smaller of the two times of
+// each residue is stored in eta_dat->tau.
+static int ess_stride(eta_res_dat_t *eta_dat, rvec **x1, rvec **x2, int nframes, const t_atoms *atoms) {
+    int nlags = 0, stride = nframes, limit = -1;
+    double *rho1, *rho2;
+    int r;
+
+    while (nframes >= ESS_MIN_FRAMES && (2 << nlags) <= nframes / 4) {
+        ++nlags;
+    }
+    if (nlags == 0) {
+        gk_print_log("Too few frames to measure autocorrelation, not striding.\n");
+        return 1;
+    }
+    gk_print_log("Measuring autocorrelation times at lags up to %d frames...\n", 1 << (nlags - 1));
+
+    snew(rho1, atoms->nres * nlags);
+    snew(rho2, atoms->nres * nlags);
+    res_autocorr(x1, nframes, atoms, nlags, rho1);
+    res_autocorr(x2, nframes, atoms, nlags, rho2);
+
+    for (r = 0; r < atoms->nres; ++r) {
+        double q1 = autocorr_decay(rho1 + r * nlags, nlags);
+        double q2 = autocorr_decay(rho2 + r * nlags, nlags);
+        // the faster trajectory loses more of its effective samples to a stride
+        double q = q1 < q2 ? q1 : q2;
+        double keep = eta_dat->ess_keep * ess_fraction(q, 1);
+        int s = 1;
+
+        while (s < stride && ess_fraction(q, s + 1) >= keep) {
+            ++s;
+        }
+        eta_dat->tau[r] = q < 1 ? (1 + q) / (1 - q) : nframes;
+        if (s < stride) {
+            stride = s;
+            limit = r;
+        }
+    }
+    if (stride > nframes / ESS_MIN_FRAMES) {
+        stride = nframes / ESS_MIN_FRAMES > 1 ? nframes / ESS_MIN_FRAMES : 1;
+    }
+    if (limit >= 0) {
+        gk_print_log("Residue %d%s has the shortest autocorrelation time, %.1f frames (effective sample size %.0f).\n",
+            eta_dat->res_IDs[limit], eta_dat->res_names[limit], eta_dat->tau[limit], nframes / eta_dat->tau[limit]);
+    }
+
+    sfree(rho1);
+    sfree(rho2);
+    return stride;
+}
+
+// Keeps every stride-th frame of x, freeing the others. Returns the new number of frames.
+static int stride_traj(rvec **x, int nframes, int stride) {
+    int f, n = 0;
+
+    for (f = 0; f < nframes; ++f) {
+        if (f % stride == 0) {
+            x[n++] = x[f];
+        }
+        else {
+            sfree(x[f]);
+        }
+    }
+    return n;
+}
+
 void init_eta_dat(eta_res_dat_t *eta_dat) {
     eta_dat->gamma = GAMMA;
     eta_dat->c = COST;
     eta_dat->nthreads = -1;
     eta_dat->oenv = NULL;
+    eta_dat->gamma_grid = NULL;
+    eta_dat->c_grid = NULL;
+    eta_dat->cache_type = CACHE_FLOAT;
+    eta_dat->ncheck = 3;
+    eta_dat->cache_policy = CACHE_LRU;
+    eta_dat->mixed_precision = FALSE;
+    eta_dat->kernel_drop = 0;
+    eta_dat->dc_clusters = 0;
+    eta_dat->sv_screen = 0;
+    eta_dat->warm_start = FALSE;
+    eta_dat->approx_dim = 0;
+    eta_dat->linear_screen = 0;
+    eta_dat->moment_screen = 0;
+    eta_dat->coarse_eps = 0;
+    eta_dat->refine_eta = 0;
+    eta_dat->refine_top = 0;
+    eta_dat->max_iter = 0;
+    eta_dat->max_time = 0;
+    eta_dat->deadline = 0;
+    eta_dat->collapse_duplicates = FALSE;
+    eta_dat->coreset = 0;
+    eta_dat->ess_keep = 0;
+    eta_dat->curve_sizes = 0;
+    eta_dat->curve_tol = 0.01;
+    eta_dat->nboot = 0;
+    eta_dat->boot_block = 1;
+    eta_dat->nperm = 0;
+    eta_dat->window = 0;
+    eta_dat->window_step = 0;
+    eta_dat->window_ref = FALSE;
 
     eta_dat->nres = 0;
     eta_dat->res_IDs = NULL;
     eta_dat->res_names = NULL;
     eta_dat->res_natoms = NULL;
     eta_dat->eta = NULL;
+    eta_dat->eta_err = NULL;
+    eta_dat->eta_linear = NULL;
+    eta_dat->eta_moment = NULL;
+    eta_dat->eta_refined = NULL;
+    eta_dat->res_info = NULL;
+    eta_dat->tau = NULL;
+    eta_dat->stride = 1;
+    eta_dat->curve_frames = NULL;
+    eta_dat->eta_curve = NULL;
+    eta_dat->eta_converged = NULL;
+    eta_dat->eta_lo = NULL;
+    eta_dat->eta_hi = NULL;
+    eta_dat->eta_pvalue = NULL;
+    eta_dat->nwindows = 0;
+    eta_dat->eta_window = NULL;
+
+    eta_dat->ngamma = 0;
+    eta_dat->gammas = NULL;
+    eta_dat->nc = 0;
+    eta_dat->cs = NULL;
+    eta_dat->eta_sweep = NULL;
 
     eta_dat->natoms_all = 0;
 }
@@ -111,6 +1199,22 @@ void free_eta_dat(eta_res_dat_t *eta_dat) {
     if (eta_dat->res_names)  sfree(eta_dat->res_names);
     if (eta_dat->res_natoms) sfree(eta_dat->res_natoms);
     if (eta_dat->eta)        sfree(eta_dat->eta);
+    if (eta_dat->eta_err)    sfree(eta_dat->eta_err);
+    if (eta_dat->eta_linear) sfree(eta_dat->eta_linear);
+    if (eta_dat->eta_moment)  sfree(eta_dat->eta_moment);
+    if (eta_dat->eta_refined) sfree(eta_dat->eta_refined);
+    if (eta_dat->res_info)   sfree(eta_dat->res_info);
+    if (eta_dat->tau)        sfree(eta_dat->tau);
+    if (eta_dat->curve_frames) sfree(eta_dat->curve_frames);
+    if (eta_dat->eta_curve)  sfree(eta_dat->eta_curve);
+    if (eta_dat->eta_converged) sfree(eta_dat->eta_converged);
+    if (eta_dat->eta_lo)     sfree(eta_dat->eta_lo);
+    if (eta_dat->eta_hi)     sfree(eta_dat->eta_hi);
+    if (eta_dat->eta_pvalue) sfree(eta_dat->eta_pvalue);
+    if (eta_dat->eta_window) sfree(eta_dat->eta_window);
+    if (eta_dat->gammas)     sfree(eta_dat->gammas);
+    if (eta_dat->cs)         sfree(eta_dat->cs);
+    if (eta_dat->eta_sweep)  sfree(eta_dat->eta_sweep);
 }
 
 
@@ -120,13 +1224,21 @@ void ensemble_res_comp(eta_res_dat_t *eta_dat) {
     const char *ndx_error = "Given index groups have differing numbers of atoms!\n";
     const char *natom_error = "Input trajectories have differing numbers of atoms!\n";
 
+    // start of the run, for eta_dat->deadline
+    double t_start = svm_wall_time();
+
     /* Trajectory data */
     rvec **x1, **x2; // Trajectory position vectors
     int nframes, nframes2, natoms2, i;
 
     /* Training data */
     struct svm_problem *probs; // svm problems for training
-    struct svm_model **models; // pointers to models produced by training
+    struct svm_parameter param; // parameters used for training
+    int *nsv; // number of support vectors of each problem
+
+    if (eta_dat->ess_keep < 0 || eta_dat->ess_keep > 1) {
+        gk_log_fatal(FARGS, "Effective sample size fraction %f is not between 0 and 1.\n", eta_dat->ess_keep);
+    }
 
     /* Read trajectory files */
     matrix *box = NULL;
@@ -150,7 +1262,7 @@ void ensemble_res_comp(eta_res_dat_t *eta_dat) {
         default:
             gk_log_fatal(FARGS, io_error);
     }
-    sfre(box); // don't need box data
+    sfree(box); // don't need box data
     box = NULL;
 
     /* In case traj files have different numbers of frames */
@@ -215,15 +1327,44 @@ void ensemble_res_comp(eta_res_dat_t *eta_dat) {
         default:
             gk_log_fatal(FARGS, "%s is not a supported filetype for residue information. Skipping eta residue calculation.\n",
                 eta_dat->fnames[eRES1]);
-            flush_log();
+            gk_flush_log();
+    }
+
+    /* Residue output data */
+    eta_dat->nres = atoms.nres;
+    snew(eta_dat->res_IDs, eta_dat->nres);
+    snew(eta_dat->res_names, eta_dat->nres);
+    snew(eta_dat->res_natoms, eta_dat->nres);
+    for (i = 0; i < eta_dat->nres; ++i) {
+        eta_dat->res_IDs[i] = atoms.resinfo[i].nr;
+        eta_dat->res_names[i] = *(atoms.resinfo[i].name);
+    }
+    for (i = 0; i < atoms.nr; ++i) {
+        ++eta_dat->res_natoms[atoms.atom[i].resind];
+    }
+
+    /* Thin correlated frames */
+    if (eta_dat->ess_keep > 0) {
+        snew(eta_dat->tau, eta_dat->nres);
+        eta_dat->stride = ess_stride(eta_dat, x1, x2, nframes, &atoms);
+        if (eta_dat->stride > 1) {
+            int nkept = stride_traj(x1, nframes, eta_dat->stride);
+            stride_traj(x2, nframes, eta_dat->stride);
+            gk_print_log("Striding by %d frames, keeping %d of %d frames per trajectory.\n",
+                eta_dat->stride, nkept, nframes);
+            nframes = nkept;
+        }
+        else {
+            gk_print_log("Autocorrelation times allow no stride, keeping all %d frames.\n", nframes);
+        }
     }
 
     /* Construct svm problems */
     traj_res2svm_probs(x1, x2, indx1[0], indx2[0], nframes, &atoms, &probs);
 
     /* No longer need original vectors */
-    free_traj(x1, nframes);
-    free_traj(x2, nframes);
+    gk_free_traj(x1, nframes, eta_dat->natoms_all);
+    gk_free_traj(x2, nframes, natoms2);
 
     /* No longer need index junk (except for what we stored in atom_IDs) */
     sfree(isize);
@@ -235,16 +1376,268 @@ void ensemble_res_comp(eta_res_dat_t *eta_dat) {
         sfree(indx2);
     }
 
-    /* Train SVM */
-    snew(models, eta_dat->nres);
-    train_svm_probs(probs, eta_dat->nres, eta_dat->gamma, eta_dat->c, eta_dat->nthreads, models);
+    init_svm_param(&param, eta_dat->gamma, eta_dat->c);
+    param.cache_type = eta_dat->cache_type;
+    param.cache_policy = eta_dat->cache_policy;
+    param.mixed_precision = eta_dat->mixed_precision;
+    param.kernel_drop = eta_dat->kernel_drop;
+    param.dc_clusters = eta_dat->dc_clusters;
+    param.sv_screen = eta_dat->sv_screen;
+    param.max_iter = eta_dat->max_iter;
+    param.max_time = eta_dat->max_time;
+    param.deadline = eta_dat->deadline > 0 ? t_start + eta_dat->deadline : 0;
+    param.collapse_duplicates = eta_dat->collapse_duplicates ? COLLAPSE_FRAMES : COLLAPSE_OFF;
+    param.coreset = eta_dat->coreset;
+
+    if (eta_dat->kernel_drop < 0 || eta_dat->kernel_drop >= 1) {
+        gk_log_fatal(FARGS, "Kernel drop threshold %f is not in [0,1).\n", eta_dat->kernel_drop);
+    }
+    if (eta_dat->kernel_drop > 0 && eta_dat->cache_type != CACHE_FLOAT) {
+        gk_log_fatal(FARGS, "Dropping small kernel entries needs a float kernel cache.\n");
+    }
+    if (eta_dat->sv_screen > 0 && eta_dat->dc_clusters > 1) {
+        gk_log_fatal(FARGS, "Support vector screening and clustered training cannot be combined.\n");
+    }
+    if (eta_dat->linear_screen < 0 || eta_dat->linear_screen > 1) {
+        gk_log_fatal(FARGS, "Linear pre-screen threshold %f is not in [0,1].\n", eta_dat->linear_screen);
+    }
+    if (eta_dat->moment_screen < 0 || eta_dat->moment_screen > 1) {
+        gk_log_fatal(FARGS, "Moment pre-screen threshold %f is not in [0,1].\n", eta_dat->moment_screen);
+    }
+    if (eta_dat->linear_screen > 0 && eta_dat->ncheck < 1) {
+        gk_log_fatal(FARGS, "The linear pre-screen needs -kcheck of at least 1 to check it.\n");
+    }
+    if (eta_dat->moment_screen > 0 && eta_dat->ncheck < 1) {
+        gk_log_fatal(FARGS, "The moment pre-screen needs -kcheck of at least 1 to check the estimate.\n");
+    }
+    if (eta_dat->window < 0 || eta_dat->window > nframes || eta_dat->window_step < 0) {
+        gk_log_fatal(FARGS, "Window of %d frames every %d frames does not fit %d frames.\n",
+            eta_dat->window, eta_dat->window_step, nframes);
+    }
+    if (eta_dat->curve_sizes < 0 || eta_dat->curve_tol < 0) {
+        gk_log_fatal(FARGS, "Learning curve sizes and tolerance must not be negative.\n");
+    }
+    if (eta_dat->curve_sizes > 0 && (nframes - 1) >> (eta_dat->curve_sizes - 1) == 0) {
+        gk_log_fatal(FARGS, "%d frames are too few for %d learning curve subsets.\n",
+            nframes, eta_dat->curve_sizes);
+    }
+    if (eta_dat->nboot < 0 || eta_dat->nperm < 0 || eta_dat->boot_block < 1 || eta_dat->boot_block > nframes) {
+        gk_log_fatal(FARGS, "Bootstrap and permutations need a non-negative number of samples and a block of 1 to %d frames.\n",
+            nframes);
+    }
+    if (eta_dat->coreset < 0) {
+        gk_log_fatal(FARGS, "Coreset size %d is negative.\n", eta_dat->coreset);
+    }
+    if (eta_dat->coreset > 0 && eta_dat->ncheck < 1) {
+        gk_log_fatal(FARGS, "The coreset needs -kcheck of at least 1 to measure its sensitivity.\n");
+    }
+    if (eta_dat->max_iter < 0 || eta_dat->max_time < 0 || eta_dat->deadline < 0) {
+        gk_log_fatal(FARGS, "Iteration and time budgets must not be negative.\n");
+    }
+    if (eta_dat->coarse_eps > 0 && eta_dat->coarse_eps <= param.eps) {
+        gk_log_fatal(FARGS, "Coarse tolerance %f must be larger than the final tolerance %f.\n",
+            eta_dat->coarse_eps, param.eps);
+    }
+    {
+        // the sweep, windows, learning curve and approximation each replace training every
+        // residue on all frames, which the screens, -ceps, -warm, -boot and -perm build on
+        const char *mode = NULL;
+        int nmodes = 0;
+
+        if (eta_dat->gamma_grid != NULL || eta_dat->c_grid != NULL) {
+            mode = "A (gamma, C) sweep";
+            ++nmodes;
+        }
+        if (eta_dat->window > 0) {
+            mode = "-window";
+            ++nmodes;
+        }
+        if (eta_dat->curve_sizes > 0) {
+            mode = "-lcurve";
+            ++nmodes;
+        }
+        if (eta_dat->approx_dim > 0) {
+            mode = "-approx";
+            ++nmodes;
+        }
+        if (nmodes > 1) {
+            gk_log_fatal(FARGS, "Only one of -gsweep/-csweep, -window, -lcurve and -approx can be used.\n");
+        }
+        if (mode != NULL && (eta_dat->nboot > 0 || eta_dat->nperm > 0 || eta_dat->linear_screen > 0 ||
+                             eta_dat->moment_screen > 0 || eta_dat->coarse_eps > 0 || eta_dat->warm_start)) {
+            gk_log_fatal(FARGS, "%s cannot be combined with -boot, -perm, -linscreen, -mscreen, -ceps or -warm.\n",
+                mode);
+        }
+        // the coreset is only checked against all frames when every residue is trained
+        if (mode != NULL && eta_dat->coreset > 0) {
+            gk_log_fatal(FARGS, "%s cannot be combined with -coreset.\n", mode);
+        }
+        // the learning curve trains its subsets with svm_train_nsv_from, which collapses them
+        if (mode != NULL && eta_dat->curve_sizes == 0 && eta_dat->collapse_duplicates) {
+            gk_log_fatal(FARGS, "%s cannot be combined with -dedup.\n", mode);
+        }
+    }
+
+    if (eta_dat->gamma_grid != NULL || eta_dat->c_grid != NULL) {
+        /* Sweep the (gamma, C) grid, one eta per residue and grid point */
+        int npairs, p;
 
-    /* calculate eta per residue */
-    calc_eta(models, eta_dat->natoms, nframes, eta_dat->eta);
+        parse_grid(eta_dat->gamma_grid, eta_dat->gamma, &eta_dat->ngamma, &eta_dat->gammas);
+        parse_grid(eta_dat->c_grid, eta_dat->c, &eta_dat->nc, &eta_dat->cs);
+        npairs = eta_dat->ngamma * eta_dat->nc;
+
+        snew(nsv, eta_dat->nres * npairs);
+        sweep_svm_probs(probs, eta_dat->nres, &param, eta_dat->ngamma, eta_dat->gammas,
+            eta_dat->nc, eta_dat->cs, eta_dat->nthreads, nsv);
+
+        snew(eta_dat->eta_sweep, eta_dat->nres * npairs);
+        for (p = 0; p < eta_dat->nres * npairs; ++p) {
+            eta_dat->eta_sweep[p] = 1.0 - nsv[p] / (2.0 * (real)nframes);
+        }
+        sfree(nsv);
+    }
+    else if (eta_dat->window > 0) {
+        /* Slide a window along both trajectories */
+        int w = eta_dat->window, step, p;
+
+        if (eta_dat->window_step == 0) {
+            eta_dat->window_step = w / 2 > 0 ? w / 2 : 1;
+        }
+        step = eta_dat->window_step;
+        eta_dat->nwindows = (nframes - w) / step + 1;
+        gk_print_log("Training %d windows of %d frames, every %d frames, against %s...\n",
+            eta_dat->nwindows, w, step,
+            eta_dat->window_ref ? "frames spread over trajectory 2" : "the same frames of trajectory 2");
+
+        snew(nsv, eta_dat->nres * eta_dat->nwindows);
+        window_svm_probs(probs, eta_dat->nres, &param, nframes, w, step, eta_dat->window_ref,
+            eta_dat->nthreads, nsv);
+
+        snew(eta_dat->eta_window, eta_dat->nres * eta_dat->nwindows);
+        for (p = 0; p < eta_dat->nres * eta_dat->nwindows; ++p) {
+            eta_dat->eta_window[p] = 1.0 - nsv[p] / (2.0 * (real)w);
+        }
+        sfree(nsv);
+    }
+    else if (eta_dat->curve_sizes > 0) {
+        /* Grow nested frame subsets until eta settles */
+        int nsizes = eta_dat->curve_sizes, s, nsettled = 0;
+
+        snew(nsv, eta_dat->nres * nsizes);
+        curve_svm_probs(probs, eta_dat->nres, &param, nframes, nsizes, eta_dat->curve_tol,
+            eta_dat->nthreads, nsv);
+
+        snew(eta_dat->curve_frames, nsizes);
+        for (s = 0; s < nsizes; ++s) {
+            eta_dat->curve_frames[s] = (nframes - 1) / (1 << (nsizes - 1 - s)) + 1;
+        }
+        snew(eta_dat->eta, eta_dat->nres);
+        snew(eta_dat->eta_curve, eta_dat->nres * nsizes);
+        snew(eta_dat->eta_converged, eta_dat->nres);
+        for (i = 0; i < eta_dat->nres; ++i) {
+            int last = 0;
+            for (s = 0; s < nsizes; ++s) {
+                if (nsv[i * nsizes + s] < 0) {
+                    eta_dat->eta_curve[i * nsizes + s] = -1;
+                    continue;
+                }
+                eta_dat->eta_curve[i * nsizes + s] =
+                    1.0 - nsv[i * nsizes + s] / (2.0 * (real)eta_dat->curve_frames[s]);
+                last = s;
+            }
+            // eta of the largest subset trained, which is only short of all frames if eta settled
+            eta_dat->eta[i] = eta_dat->eta_curve[i * nsizes + last];
+            eta_dat->eta_converged[i] = last < nsizes - 1 || (last > 0 &&
+                fabs(eta_dat->eta[i] - eta_dat->eta_curve[i * nsizes + last - 1]) < eta_dat->curve_tol);
+            if (eta_dat->eta_converged[i]) {
+                ++nsettled;
+            }
+        }
+        gk_print_log("eta settled within %g for %d of %d residues.\n",
+            eta_dat->curve_tol, nsettled, eta_dat->nres);
+        sfree(nsv);
+    }
+    else if (eta_dat->approx_dim > 0) {
+        /* Approximate eta from two random feature draws per residue */
+        int *nsv_alt, i;
+
+        snew(nsv, eta_dat->nres);
+        snew(nsv_alt, eta_dat->nres);
+        approx_svm_probs(probs, eta_dat->nres, &param, eta_dat->approx_dim, eta_dat->nthreads, nsv, nsv_alt);
+
+        snew(eta_dat->eta, eta_dat->nres);
+        snew(eta_dat->eta_err, eta_dat->nres);
+        for (i = 0; i < eta_dat->nres; ++i) {
+            eta_dat->eta[i] = 1.0 - (nsv[i] + nsv_alt[i]) / (4.0 * (real)nframes);
+            eta_dat->eta_err[i] = abs(nsv[i] - nsv_alt[i]) / (2.0 * (real)nframes);
+        }
+        sfree(nsv);
+        sfree(nsv_alt);
+    }
+    else {
+        /* Train SVM */
+        float **alphas = NULL; // solutions on all frames, to start bootstrap resamples from
+
+        snew(nsv, eta_dat->nres);
+        if (eta_dat->nboot > 0) {
+            snew(alphas, eta_dat->nres);
+        }
+        if (eta_dat->fnames[eCACHE_STATS] != NULL || param.kernel_drop > 0 || eta_dat->warm_start ||
+            param.max_iter > 0 || param.max_time > 0 || param.deadline > 0 || param.coreset > 0) {
+            snew(eta_dat->res_info, eta_dat->nres);
+        }
+        if (eta_dat->moment_screen > 0) {
+            snew(eta_dat->eta_moment, eta_dat->nres);
+            moment_eta_probs(probs, eta_dat->nres, eta_dat->nthreads, eta_dat->eta_moment);
+            check_moment_eta(eta_dat, probs, &param, nframes);
+        }
+        train_screened_probs(eta_dat, probs, &param, nframes, nsv, alphas);
+        if (param.kernel_drop > 0) {
+            report_kernel_drop(eta_dat, &param);
+        }
+        if (param.max_iter > 0 || param.max_time > 0 || param.deadline > 0) {
+            report_budgets(eta_dat, &param);
+        }
+
+        /* calculate eta per residue */
+        snew(eta_dat->eta, eta_dat->nres);
+        calc_eta(nsv, eta_dat->nres, nframes, eta_dat->eta);
+        sfree(nsv);
+        if (eta_dat->eta_moment) {
+            // skipped residues were not trained and take their moment estimate
+            for (i = 0; i < eta_dat->nres; ++i) {
+                if (eta_dat->eta_moment[i] < eta_dat->moment_screen) {
+                    eta_dat->eta[i] = eta_dat->eta_moment[i];
+                }
+            }
+        }
+
+        if (param.cache_type != CACHE_FLOAT && eta_dat->ncheck > 0) {
+            check_cache_eta(eta_dat, probs, &param, nframes);
+        }
+        if (param.coreset > 0 && eta_dat->ncheck > 0) {
+            check_coreset_eta(eta_dat, probs, &param, nframes);
+        }
+        if (param.mixed_precision && eta_dat->ncheck > 0) {
+            check_mixed_eta(eta_dat, probs, &param, nframes);
+        }
+        if (eta_dat->warm_start && eta_dat->ncheck > 0) {
+            check_warm_eta(eta_dat, probs, &param, nframes);
+        }
+        if (eta_dat->nperm > 0) {
+            perm_eta(eta_dat, probs, &param, nframes);
+        }
+        if (alphas) {
+            boot_eta(eta_dat, probs, &param, nframes, alphas);
+            for (i = 0; i < eta_dat->nres; ++i) {
+                if (alphas[i]) sfree(alphas[i]);
+            }
+            sfree(alphas);
+        }
+    }
 
     /* Clean up svm stuff */
     free_svm_probs(probs, eta_dat->nres, nframes * 2);
-    free_svm_models(models, eta_dat->nres);
 }
 
 void traj_res2svm_probs(rvec **x1,
@@ -261,7 +1654,7 @@ void traj_res2svm_probs(rvec **x1,
 
     gk_print_log("Constructing svm problems for %d residues in %d frames...\n",
         atoms->nres, nframes);
-    flush_log();
+    gk_flush_log();
 
     // Build targets array with classification labels
     snew(targets, nvecs);
@@ -293,7 +1686,7 @@ void traj_res2svm_probs(rvec **x1,
 
     // Allocate enough space for storing all svm nodes
     // 2 trajectories * natoms * nframes * (3 coordinates per atom + one node for the -1 end index)
-    snew(nodepool, 2 * natoms * nframes * 4);
+    snew(nodepool, 2 * atoms->nr * nframes * 4);
     if (!nodepool)
         gk_log_fatal(FARGS, "Failed to allocate memory for svm training vectors!\n");
 
@@ -301,7 +1694,7 @@ void traj_res2svm_probs(rvec **x1,
     // TODO: de-duplicate code pls
     snew(*probs, atoms->nres);
     int cur_res, cur_frame, cur_data;
-    for (cur_res = 0; cur_res < eta_dat->nres; ++cur_res) {
+    for (cur_res = 0; cur_res < atoms->nres; ++cur_res) {
         printf("Residue %d...\r", cur_res);
         fflush(stdout);
 
@@ -387,29 +1780,14 @@ void free_svm_probs(struct svm_problem *probs,
 
 void train_svm_probs(struct svm_problem *probs,
                      int num_probs,
-                     real gamma,
-                     real c,
+                     const struct svm_parameter *param,
                      int nthreads,
-                     struct svm_model **models) {
-    struct svm_parameter param; // Parameters used for training
-
-    gk_print_log("svm-training trajectory atoms with gamma = %f and C = %f...\n", gamma, c);
-    flush_log();
-
-    /* Set svm parameters */
-    param.svm_type = C_SVC;
-    param.kernel_type = RBF;
-    param.degree = 3;
-    param.gamma = gamma;
-    param.coef0 = 0.0;
-    param.cache_size = 100.0;
-    param.eps = 0.001;
-    param.C = c;
-    param.nr_weight = 0;
-    param.nu = 0.5;
-    param.p = 0.1;
-    param.shrinking = 1;
-    param.probability = 0;
+                     int *nsv,
+                     struct svm_solve_info *info,
+                     gmx_bool warm_start,
+                     float **alphas) {
+    gk_print_log("svm-training trajectory atoms with gamma = %f and C = %f...\n", param->gamma, param->C);
+    gk_flush_log();
 
 #ifdef _OPENMP
     if (nthreads > 0)
@@ -419,58 +1797,724 @@ void train_svm_probs(struct svm_problem *probs,
 #endif
 
     /* Train svm */
-    int i;
-#pragma omp parallel for schedule(dynamic) private(i) shared(num_probs,models,probs,param)
+    int i, c;
+    // Sequence neighbours move together and share most of their SVs, so with warm starts
+    // each thread takes chains of WARM_CHAIN residues and trains them in chain order.
+    int chain = warm_start ? WARM_CHAIN : 1;
+    int nchains = (num_probs + chain - 1) / chain;
+    int maxl = 0;
     for (i = 0; i < num_probs; ++i) {
+        if (probs[i].l > maxl) {
+            maxl = probs[i].l;
+        }
+    }
+    // With fewer residues than threads, clustered solves use the threads within each residue instead
+    int per_residue = 1;
+#ifdef _OPENMP
+    per_residue = param->dc_clusters <= 1 || num_probs >= omp_get_max_threads();
+#endif
+#pragma omp parallel shared(num_probs,nsv,info,probs) if(per_residue)
+    {
+        // each thread reuses one workspace for all of its problems
+        struct svm_workspace *ws = svm_workspace_create();
+        double *alpha = NULL;
+        if (warm_start || alphas) {
+            snew(alpha, maxl);
+        }
+
     #if defined _OPENMP && defined EC_DEBUG
         gk_print_log("%d threads running svm-train.\n", omp_get_num_threads());
     #endif
-        models[i] = svm_train(&(probs[i]), &param);
+#pragma omp for schedule(dynamic) private(i,c)
+        for (c = 0; c < nchains; ++c) {
+            int first = c * chain, solved = 0;
+            for (i = first; i < num_probs && i < first + chain; ++i) {
+                const double *alpha0 = solved ? alpha : NULL;
+                int k;
+                if (alphas && alphas[i]) {
+                    for (k = 0; k < probs[i].l; ++k) {
+                        alpha[k] = alphas[i][k];
+                    }
+                    alpha0 = alpha;
+                }
+                nsv[i] = svm_train_nsv_from(&(probs[i]), param, ws, alpha0, NULL);
+                if (warm_start || alphas) {
+                    solved = svm_get_alpha(ws, alpha) == probs[i].l;
+                }
+                if (alphas && solved) {
+                    if (!alphas[i]) {
+                        snew(alphas[i], probs[i].l);
+                    }
+                    for (k = 0; k < probs[i].l; ++k) {
+                        alphas[i][k] = alpha[k];
+                    }
+                }
+                if (info) {
+                    svm_get_solve_info(ws, &info[i]);
+                }
+            }
+        }
+
+        if (alpha) sfree(alpha);
+        svm_workspace_destroy(ws);
+    }
+
+    if (warm_start && info) {
+        // chain heads start from 0, so they show what the others would cost cold
+        double cold = 0, warm = 0;
+        int ncold = 0, nwarm = 0;
+        for (i = 0; i < num_probs; ++i) {
+            if (i % chain == 0) {
+                cold += info[i].iterations;
+                ++ncold;
+            }
+            else {
+                warm += info[i].iterations;
+                ++nwarm;
+            }
+        }
+        if (nwarm > 0) {
+            gk_print_log("Average SMO iterations: %.0f for %d cold starts, %.0f for %d warm starts\n",
+                cold / ncold, ncold, warm / nwarm, nwarm);
+        }
     }
 }
 
-static void free_svm_model(struct svm_model *model) {
-    svm_free_model_content(model);
-    svm_free_and_destroy_model(&model);
+void approx_svm_probs(struct svm_problem *probs,
+                      int num_probs,
+                      const struct svm_parameter *param,
+                      int ndim,
+                      int nthreads,
+                      int *nsv,
+                      int *nsv_alt) {
+    gk_print_log("approximating svm-training with %d random features, gamma = %f and C = %f...\n",
+        ndim, param->gamma, param->C);
+    gk_flush_log();
+
+#ifdef _OPENMP
+    if (nthreads > 0)
+        omp_set_num_threads(nthreads);
+#endif
+
+    int i;
+#pragma omp parallel for schedule(dynamic) private(i) shared(num_probs,nsv,nsv_alt,probs)
+    for (i = 0; i < num_probs; ++i) {
+        // the seeds only depend on the residue, so results do not depend on the thread count
+        nsv[i] = svm_train_nsv_rff(&(probs[i]), param, ndim, 2 * i + 1);
+        nsv_alt[i] = svm_train_nsv_rff(&(probs[i]), param, ndim, 2 * i + 2);
+    }
 }
 
-void free_svm_models(struct svm_model **models, int num_models) {
-    for (int i = 0; i < num_models; ++i) {
-        free_svm_model(models[i]);
+void moment_eta_probs(struct svm_problem *probs,
+                      int num_probs,
+                      int nthreads,
+                      real *estimate) {
+    gk_print_log("Estimating residue separability from ensemble moments...\n");
+    gk_flush_log();
+
+#ifdef _OPENMP
+    if (nthreads > 0)
+        omp_set_num_threads(nthreads);
+#endif
+
+    int i;
+#pragma omp parallel for schedule(dynamic) private(i) shared(num_probs,estimate,probs)
+    for (i = 0; i < num_probs; ++i) {
+        estimate[i] = moment_estimate(&(probs[i]));
     }
-    sfree(models);
 }
 
+void linear_svm_probs(struct svm_problem *probs,
+                      int num_probs,
+                      const struct svm_parameter *param,
+                      int nthreads,
+                      int *nsv) {
+    gk_print_log("svm-training trajectory atoms with a linear kernel and C = %f...\n", param->C);
+    gk_flush_log();
+
+#ifdef _OPENMP
+    if (nthreads > 0)
+        omp_set_num_threads(nthreads);
+#endif
+
+    int i;
+#pragma omp parallel for schedule(dynamic) private(i) shared(num_probs,nsv,probs)
+    for (i = 0; i < num_probs; ++i) {
+        nsv[i] = svm_train_nsv_linear(&(probs[i]), param);
+    }
+}
 
-void calc_eta(struct svm_model **models,
-              int num_models,
+void sweep_svm_probs(struct svm_problem *probs,
+                     int num_probs,
+                     const struct svm_parameter *param,
+                     int ngamma,
+                     real *gammas,
+                     int nc,
+                     real *cs,
+                     int nthreads,
+                     int *nsv) {
+    double *g, *c;
+    float **d2 = NULL; // squared distance matrix of each residue in a group
+    struct svm_problem *members; // residues of the current group
+    int *order; // residue indices by size
+    int group = 1, first, l, r, i;
+
+    gk_print_log("svm-training trajectory atoms over %d gamma and %d C values...\n", ngamma, nc);
+    gk_flush_log();
+
+    // libsvm takes double grids
+    snew(g, ngamma);
+    snew(c, nc);
+    for (i = 0; i < ngamma; ++i) g[i] = gammas[i];
+    for (i = 0; i < nc; ++i)     c[i] = cs[i];
+
+#ifdef _OPENMP
+    if (nthreads > 0)
+        omp_set_num_threads(nthreads);
+    if (nthreads > 1 || nthreads <= 0)
+        gk_print_log("svm training will be parallelized.\n");
+#endif
+
+    // residues in order of size, so that a group holds residues of similar size
+    snew(order, num_probs);
+    for (i = 0; i < num_probs; ++i) {
+        order[i] = i;
+    }
+    sort_probs = probs;
+    qsort(order, num_probs, sizeof(int), cmp_prob_dim);
+
+    l = probs[0].l;
+    if (ngamma > 1 && (double)l * l * sizeof(float) <= param->cache_size * (1 << 20)) {
+        /* The distance matrices are shared between gammas. Build them for a
+         * group of residues at a time, one residue per thread, with a fused
+         * pass over frame pairs that reads each frame once for the whole group. */
+#ifdef _OPENMP
+        group = omp_get_max_threads();
+#endif
+        snew(d2, group);
+        for (r = 0; r < group; ++r) {
+            snew(d2[r], (size_t)l * l);
+        }
+    }
+    snew(members, group);
+
+    for (first = 0; first < num_probs; first += group) {
+        int n = first + group <= num_probs ? group : num_probs - first;
+        struct svm_frame_block *block = NULL;
+
+        for (r = 0; r < n; ++r) {
+            members[r] = probs[order[first + r]];
+        }
+        if (d2) {
+            block = svm_frame_block_create(members, n);
+        }
+
+#pragma omp parallel shared(probs,g,c,nsv,block,d2,members,order,first,n,l) private(i)
+        {
+            struct svm_workspace *ws = svm_workspace_create();
+
+            if (block) {
+#pragma omp for schedule(dynamic)
+                for (i = 0; i < l; i += D2_ROWS) {
+                    svm_frame_block_sq_dist(block, i, i + D2_ROWS < l ? i + D2_ROWS : l, d2);
+                }
+#pragma omp for schedule(dynamic)
+                for (i = 0; i < l; i += D2_ROWS) {
+                    svm_frame_block_mirror(block, i, i + D2_ROWS < l ? i + D2_ROWS : l, d2);
+                }
+            }
+
+#pragma omp for schedule(dynamic)
+            for (i = 0; i < n; ++i) {
+                svm_sweep_nsv(&members[i], param, ngamma, g, nc, c, block ? d2[i] : NULL,
+                    ws, &nsv[order[first + i] * ngamma * nc]);
+            }
+
+            svm_workspace_destroy(ws);
+        }
+
+        if (block) {
+            svm_frame_block_destroy(block);
+        }
+    }
+
+    if (d2) {
+        for (r = 0; r < group; ++r) {
+            sfree(d2[r]);
+        }
+        sfree(d2);
+    }
+    sfree(members);
+    sfree(order);
+
+    sfree(g);
+    sfree(c);
+}
+
+void curve_svm_probs(struct svm_problem *probs,
+                     int num_probs,
+                     const struct svm_parameter *param,
+                     int nframes,
+                     int nsizes,
+                     real tol,
+                     int nthreads,
+                     int *nsv) {
+    gk_print_log("svm-training on %d nested frame subsets with gamma = %f and C = %f...\n",
+        nsizes, param->gamma, param->C);
+    gk_flush_log();
+
+#ifdef _OPENMP
+    if (nthreads > 0)
+        omp_set_num_threads(nthreads);
+#endif
+
+    int i;
+#pragma omp parallel shared(num_probs,nsv,probs)
+    {
+        struct svm_workspace *ws = svm_workspace_create();
+        struct svm_problem sub;
+        double *alpha, *alpha0;
+        snew(sub.x, 2 * nframes);
+        snew(sub.y, 2 * nframes);
+        snew(alpha, 2 * nframes);
+        snew(alpha0, 2 * nframes);
+
+#pragma omp for schedule(dynamic) private(i)
+        for (i = 0; i < num_probs; ++i) {
+            int prev = 0, s;
+            double eta_prev = 0;
+
+            for (s = 0; s < nsizes; ++s) {
+                nsv[i * nsizes + s] = -1;
+            }
+            for (s = 0; s < nsizes; ++s) {
+                // every stride-th frame of each trajectory; the previous subset took every 2 * stride-th
+                int stride = 1 << (nsizes - 1 - s);
+                int m = (nframes - 1) / stride + 1;
+                double eta;
+                int j, c;
+
+                sub.l = 2 * m;
+                for (c = 0; c < 2; ++c) {
+                    for (j = 0; j < m; ++j) {
+                        sub.x[c * m + j] = probs[i].x[c * nframes + j * stride];
+                        sub.y[c * m + j] = probs[i].y[c * nframes + j * stride];
+                        alpha0[c * m + j] = s > 0 && j % 2 == 0 ? alpha[c * prev + j / 2] : 0;
+                    }
+                }
+                nsv[i * nsizes + s] = svm_train_nsv_from(&sub, param, ws, s > 0 ? alpha0 : NULL, NULL);
+                eta = 1.0 - nsv[i * nsizes + s] / (2.0 * (real)m);
+                if (s > 0 && fabs(eta - eta_prev) < tol) {
+                    break;
+                }
+                if (svm_get_alpha(ws, alpha) != sub.l) {
+                    // no solution to start the next subset from
+                    for (j = 0; j < sub.l; ++j) {
+                        alpha[j] = 0;
+                    }
+                }
+                eta_prev = eta;
+                prev = m;
+            }
+        }
+
+        sfree(sub.x);
+        sfree(sub.y);
+        sfree(alpha);
+        sfree(alpha0);
+        svm_workspace_destroy(ws);
+    }
+}
+
+void boot_svm_probs(struct svm_problem *probs,
+                    const int *res,
+                    int num_probs,
+                    const struct svm_parameter *param,
+                    int nframes,
+                    int nboot,
+                    int block,
+                    int nthreads,
+                    float **alphas,
+                    int *nsv) {
+    // copies of a frame are collapsed into one weighted frame, so its kernel row is computed once,
+    // and each copy counts as a support vector if the frame is one
+    struct svm_parameter boot_param = *param;
+    int nshared = 0;
+    int i;
+
+    boot_param.collapse_duplicates = COLLAPSE_COPIES;
+#ifdef _OPENMP
+    if (nthreads > 0)
+        omp_set_num_threads(nthreads);
+    nthreads = omp_get_max_threads();
+#else
+    nthreads = 1;
+#endif
+
+    for (i = 0; i < num_probs; ++i) {
+        int l = probs[i].l;
+        float *kmat = NULL;
+        int b;
+
+        printf("Residue %d...\r", res[i]);
+        fflush(stdout);
+        // as in perm_svm_probs, resamples index into one kernel matrix of all frames
+        if ((double)l * l * sizeof(float) <= param->cache_size * (1 << 20) * nthreads) {
+            kmat = svm_kernel_matrix(&probs[i], param);
+        }
+        if (kmat) {
+            ++nshared;
+        }
+
+#pragma omp parallel shared(nsv,probs,kmat)
+        {
+            struct svm_workspace *ws = svm_workspace_create();
+            struct svm_problem sub;
+            double *alpha0;
+            int *rows;
+            snew(sub.x, 2 * nframes);
+            snew(sub.y, 2 * nframes);
+            snew(alpha0, 2 * nframes);
+            snew(rows, 2 * nframes);
+            sub.l = 2 * nframes;
+
+#pragma omp for schedule(dynamic) private(b)
+            for (b = 0; b < nboot; ++b) {
+                // xorshift64* seeded by residue and resample, independent of the thread
+                // and of which other residues are resampled
+                unsigned long long state = BOOT_SEED * ((unsigned long long)res[i] * nboot + b + 1);
+                int c, j, k;
+
+                for (c = 0; c < 2; ++c) {
+                    for (j = 0; j < nframes; ) {
+                        int start;
+                        state ^= state >> 12;
+                        state ^= state << 25;
+                        state ^= state >> 27;
+                        start = (int)(((state * 2685821657736338717ULL) >> 33) % (nframes - block + 1));
+                        for (k = 0; k < block && j < nframes; ++k, ++j) {
+                            int src = c * nframes + start + k;
+                            rows[c * nframes + j] = src;
+                            sub.x[c * nframes + j] = probs[i].x[src];
+                            sub.y[c * nframes + j] = probs[i].y[src];
+                            alpha0[c * nframes + j] = alphas[i] ? alphas[i][src] : 0;
+                        }
+                    }
+                }
+                nsv[i * nboot + b] = kmat ?
+                    svm_train_nsv_kernel_rows(&sub, &boot_param, kmat, l, rows, alphas[i] ? alpha0 : NULL, ws) :
+                    svm_train_nsv_from(&sub, &boot_param, ws, alphas[i] ? alpha0 : NULL, NULL);
+            }
+
+            sfree(sub.x);
+            sfree(sub.y);
+            sfree(alpha0);
+            sfree(rows);
+            svm_workspace_destroy(ws);
+        }
+        if (kmat) free(kmat);
+    }
+    printf("\n");
+    fflush(stdout);
+    gk_print_log("%d of %d residues shared one kernel matrix between their resamples.\n",
+        nshared, num_probs);
+}
+
+void perm_svm_probs(struct svm_problem *probs,
+                    const int *res,
+                    int num_probs,
+                    const struct svm_parameter *param,
+                    int nframes,
+                    int nperm,
+                    int block,
+                    int nthreads,
+                    int *nsv,
+                    int *nsv_obs) {
+    int nblocks = (nframes + block - 1) / block; // per trajectory
+    int nshared = 0;
+    int i;
+
+#ifdef _OPENMP
+    if (nthreads > 0)
+        omp_set_num_threads(nthreads);
+    nthreads = omp_get_max_threads();
+#else
+    nthreads = 1;
+#endif
+
+    for (i = 0; i < num_probs; ++i) {
+        int l = probs[i].l;
+        float *kmat = NULL;
+        int k;
+
+        printf("Residue %d...\r", res[i]);
+        fflush(stdout);
+        // the shared matrix may take as much memory as the threads' kernel caches
+        if ((double)l * l * sizeof(float) <= param->cache_size * (1 << 20) * nthreads) {
+            kmat = svm_kernel_matrix(&probs[i], param);
+        }
+        if (kmat) {
+            ++nshared;
+        }
+
+#pragma omp parallel shared(nsv,probs,kmat)
+        {
+            struct svm_workspace *ws = svm_workspace_create();
+            struct svm_problem perm = probs[i];
+            double *label;
+            snew(perm.y, l);
+            snew(label, 2 * nblocks);
+
+            // k = nperm trains the observed labels
+#pragma omp for schedule(dynamic) private(k)
+            for (k = 0; k <= nperm; ++k) {
+                // xorshift64* seeded by residue and permutation, independent of the thread
+                unsigned long long state = BOOT_SEED * ((unsigned long long)res[i] * nperm + k + 1);
+                int b, f;
+                int *out = k < nperm ? &nsv[i * nperm + k] : &nsv_obs[i];
+
+                if (k == nperm) {
+                    *out = kmat ? svm_train_nsv_kernel(&probs[i], param, kmat, NULL, ws) :
+                        svm_train_nsv(&probs[i], param, ws, NULL);
+                    continue;
+                }
+                // Fisher-Yates shuffle of the trajectory labels of the blocks
+                for (b = 0; b < 2 * nblocks; ++b) {
+                    label[b] = b < nblocks ? LABEL1 : LABEL2;
+                }
+                for (b = 2 * nblocks - 1; b > 0; --b) {
+                    int r;
+                    double t;
+                    state ^= state >> 12;
+                    state ^= state << 25;
+                    state ^= state >> 27;
+                    r = (int)(((state * 2685821657736338717ULL) >> 33) % (b + 1));
+                    t = label[b];
+                    label[b] = label[r];
+                    label[r] = t;
+                }
+                for (f = 0; f < l; ++f) {
+                    perm.y[f] = label[(f / nframes) * nblocks + (f % nframes) / block];
+                }
+                *out = kmat ? svm_train_nsv_kernel(&perm, param, kmat, NULL, ws) :
+                    svm_train_nsv(&perm, param, ws, NULL);
+            }
+
+            sfree(perm.y);
+            sfree(label);
+            svm_workspace_destroy(ws);
+        }
+        if (kmat) free(kmat);
+    }
+    printf("\n");
+    fflush(stdout);
+    gk_print_log("%d of %d residues shared one kernel matrix between their permutations.\n",
+        nshared, num_probs);
+}
+
+void window_svm_probs(struct svm_problem *probs,
+                      int num_probs,
+                      const struct svm_parameter *param,
+                      int nframes,
+                      int window,
+                      int step,
+                      gmx_bool reference,
+                      int nthreads,
+                      int *nsv) {
+    int nwindows = (nframes - window) / step + 1;
+    int l = 2 * window;
+    // overlapping windows copy their shared kernel entries if the matrices fit in the cache
+    gmx_bool reuse = (double)l * l * sizeof(float) <= param->cache_size * (1 << 20);
+
+#ifdef _OPENMP
+    if (nthreads > 0)
+        omp_set_num_threads(nthreads);
+#endif
+
+    int i;
+#pragma omp parallel shared(num_probs,nsv,probs)
+    {
+        struct svm_workspace *ws = svm_workspace_create();
+        struct svm_problem sub;
+        double *alpha, *alpha0;
+        int *old_index;
+        float *kmat = NULL, *kmat_old = NULL;
+        snew(sub.x, l);
+        snew(sub.y, l);
+        snew(alpha, l);
+        snew(alpha0, l);
+        snew(old_index, l);
+        sub.l = l;
+        if (reuse) {
+            snew(kmat, (size_t)l * l);
+            snew(kmat_old, (size_t)l * l);
+        }
+
+#pragma omp for schedule(dynamic) private(i)
+        for (i = 0; i < num_probs; ++i) {
+            int k, j;
+            for (k = 0; k < nwindows; ++k) {
+                int start = k * step;
+                const double *start_alpha = k > 0 ? alpha0 : NULL;
+
+                for (j = 0; j < window; ++j) {
+                    // frame start + j was at j + step in the previous window
+                    int moved = k > 0 && j + step < window ? j + step : -1;
+                    int f2 = reference ? (int)((long)j * nframes / window) : start + j;
+
+                    sub.x[j] = probs[i].x[start + j];
+                    sub.y[j] = probs[i].y[start + j];
+                    sub.x[window + j] = probs[i].x[nframes + f2];
+                    sub.y[window + j] = probs[i].y[nframes + f2];
+                    old_index[j] = moved;
+                    old_index[window + j] = k == 0 ? -1 : reference ? window + j :
+                                            moved >= 0 ? window + moved : -1;
+                }
+                for (j = 0; j < l; ++j) {
+                    alpha0[j] = old_index[j] >= 0 ? alpha[old_index[j]] : 0;
+                }
+
+                if (kmat) {
+                    float *t;
+                    svm_kernel_matrix_from(&sub, param, k > 0 ? kmat_old : NULL, l, old_index, kmat);
+                    nsv[i * nwindows + k] = svm_train_nsv_kernel(&sub, param, kmat, start_alpha, ws);
+                    t = kmat_old;
+                    kmat_old = kmat;
+                    kmat = t;
+                }
+                else {
+                    nsv[i * nwindows + k] = svm_train_nsv_from(&sub, param, ws, start_alpha, NULL);
+                }
+                if (svm_get_alpha(ws, alpha) != l) {
+                    // no solution to start the next window from
+                    for (j = 0; j < l; ++j) {
+                        alpha[j] = 0;
+                    }
+                }
+            }
+        }
+
+        sfree(sub.x);
+        sfree(sub.y);
+        sfree(alpha);
+        sfree(alpha0);
+        sfree(old_index);
+        if (kmat) sfree(kmat);
+        if (kmat_old) sfree(kmat_old);
+        svm_workspace_destroy(ws);
+    }
+}
+
+void calc_eta(int *nsv,
+              int num_probs,
               int num_frames,
               real *eta) {
     int i;
 
     gk_print_log("Calculating eta values...\n");
-    flush_log();
+    gk_flush_log();
 
-    for (i = 0; i < num_models; ++i) {
-        eta[i] = 1.0 - svm_get_nr_sv(models[i]) / (2.0 * (real)num_frames);
+    for (i = 0; i < num_probs; ++i) {
+        eta[i] = 1.0 - nsv[i] / (2.0 * (real)num_frames);
     }
 }
 
 
-void save_eta(eta_dat_t *eta_dat) {
+void save_eta(eta_res_dat_t *eta_dat) {
     // residue etas
     if (eta_dat->eta) {
         FILE *f = fopen(eta_dat->fnames[eETA_RES], "w");
+        gmx_bool budgets = eta_dat->res_info &&
+            (eta_dat->max_iter > 0 || eta_dat->max_time > 0 || eta_dat->deadline > 0);
+        gmx_bool coreset = eta_dat->res_info && eta_dat->coreset > 0;
 
         if (f) {
             gk_print_log("Saving residue eta values to %s...\n",
                 eta_dat->fnames[eETA_RES]);
 
-            fprintf(f, "# RES\tETA\n");
+            fprintf(f, "# RES\tETA");
+            if (eta_dat->eta_err) {
+                fprintf(f, "\tETA_ERR");
+            }
+            if (eta_dat->eta_linear) {
+                fprintf(f, "\tLINEAR");
+            }
+            if (eta_dat->eta_moment) {
+                fprintf(f, "\tMOMENT\tSTATIC");
+            }
+            if (eta_dat->eta_refined) {
+                fprintf(f, "\tREFINED");
+            }
+            if (budgets) {
+                fprintf(f, "\tCONVERGED\tKKT_GAP");
+            }
+            if (coreset) {
+                fprintf(f, "\tRADIUS");
+            }
+            if (eta_dat->tau) {
+                fprintf(f, "\tTAU");
+            }
+            if (eta_dat->eta_converged) {
+                fprintf(f, "\tFRAMES\tSETTLED");
+            }
+            if (eta_dat->eta_lo) {
+                fprintf(f, "\tCI_LO\tCI_HI");
+            }
+            if (eta_dat->eta_pvalue) {
+                fprintf(f, "\tPVALUE");
+            }
+            fprintf(f, "\n");
             for (int i = 0; i < eta_dat->nres; ++i) {
-                fprintf(f, "%d%s\t%f\n", eta_dat->res_IDs[i],
-                                         eta_dat->res_names[i],
-                                         eta_dat->eta[i]);
+                fprintf(f, "%d%s\t%f", eta_dat->res_IDs[i],
+                                       eta_dat->res_names[i],
+                                       eta_dat->eta[i]);
+                if (eta_dat->eta_err) {
+                    fprintf(f, "\t%f", eta_dat->eta_err[i]);
+                }
+                if (eta_dat->eta_linear) {
+                    fprintf(f, "\t%d", eta_dat->eta_linear[i] ? 1 : 0);
+                }
+                if (eta_dat->eta_moment) {
+                    fprintf(f, "\t%f\t%d", eta_dat->eta_moment[i],
+                        eta_dat->eta_moment[i] < eta_dat->moment_screen ? 1 : 0);
+                }
+                if (eta_dat->eta_refined) {
+                    fprintf(f, "\t%d", eta_dat->eta_refined[i] ? 1 : 0);
+                }
+                if (budgets) {
+                    fprintf(f, "\t%d\t%g", eta_dat->res_info[i].stopped ? 0 : 1,
+                        eta_dat->res_info[i].kkt_gap);
+                }
+                if (coreset) {
+                    fprintf(f, "\t%f", eta_dat->res_info[i].coreset_radius);
+                }
+                if (eta_dat->tau) {
+                    fprintf(f, "\t%.1f", eta_dat->tau[i]);
+                }
+                if (eta_dat->eta_converged) {
+                    int s = eta_dat->curve_sizes - 1;
+                    while (eta_dat->eta_curve[i * eta_dat->curve_sizes + s] < 0) {
+                        --s;
+                    }
+                    fprintf(f, "\t%d\t%d", eta_dat->curve_frames[s], eta_dat->eta_converged[i] ? 1 : 0);
+                }
+                if (eta_dat->eta_lo) {
+                    if (eta_dat->eta_lo[i] < 0) {
+                        fprintf(f, "\t-\t-");
+                    }
+                    else {
+                        fprintf(f, "\t%f\t%f", eta_dat->eta_lo[i], eta_dat->eta_hi[i]);
+                    }
+                }
+                if (eta_dat->eta_pvalue) {
+                    if (eta_dat->eta_pvalue[i] < 0) {
+                        fprintf(f, "\t-");
+                    }
+                    else {
+                        fprintf(f, "\t%g", eta_dat->eta_pvalue[i]);
+                    }
+                }
+                fprintf(f, "\n");
             }
 
             fclose(f);
@@ -481,5 +2525,148 @@ void save_eta(eta_dat_t *eta_dat) {
                 eta_dat->fnames[eETA_RES]);
         }
     }
-    flush_log();
+    // residue etas over the (gamma, C) grid
+    if (eta_dat->eta_sweep) {
+        FILE *f = fopen(eta_dat->fnames[eETA_SWEEP], "w");
+
+        if (f) {
+            int npairs = eta_dat->ngamma * eta_dat->nc;
+            gk_print_log("Saving residue eta values over the gamma/C grid to %s...\n",
+                eta_dat->fnames[eETA_SWEEP]);
+
+            fprintf(f, "# RES");
+            for (int g = 0; g < eta_dat->ngamma; ++g) {
+                for (int c = 0; c < eta_dat->nc; ++c) {
+                    fprintf(f, "\tg=%g,C=%g", eta_dat->gammas[g], eta_dat->cs[c]);
+                }
+            }
+            fprintf(f, "\n");
+            for (int i = 0; i < eta_dat->nres; ++i) {
+                fprintf(f, "%d%s", eta_dat->res_IDs[i], eta_dat->res_names[i]);
+                for (int p = 0; p < npairs; ++p) {
+                    fprintf(f, "\t%f", eta_dat->eta_sweep[i * npairs + p]);
+                }
+                fprintf(f, "\n");
+            }
+
+            fclose(f);
+            f = NULL;
+        }
+        else {
+            gk_print_log("Failed to open file %s for saving residue eta values.\n",
+                eta_dat->fnames[eETA_SWEEP]);
+        }
+    }
+    // residue etas against the number of frames
+    if (eta_dat->eta_curve) {
+        FILE *f = fopen(eta_dat->fnames[eETA_CURVE], "w");
+
+        if (f) {
+            int nsizes = eta_dat->curve_sizes;
+            gk_print_log("Saving residue eta values against the number of frames to %s...\n",
+                eta_dat->fnames[eETA_CURVE]);
+
+            fprintf(f, "# RES");
+            for (int s = 0; s < nsizes; ++s) {
+                fprintf(f, "\tn=%d", eta_dat->curve_frames[s]);
+            }
+            fprintf(f, "\tSETTLED\n");
+            for (int i = 0; i < eta_dat->nres; ++i) {
+                fprintf(f, "%d%s", eta_dat->res_IDs[i], eta_dat->res_names[i]);
+                for (int s = 0; s < nsizes; ++s) {
+                    if (eta_dat->eta_curve[i * nsizes + s] < 0) {
+                        fprintf(f, "\t-");
+                    }
+                    else {
+                        fprintf(f, "\t%f", eta_dat->eta_curve[i * nsizes + s]);
+                    }
+                }
+                fprintf(f, "\t%d\n", eta_dat->eta_converged[i] ? 1 : 0);
+            }
+
+            fclose(f);
+            f = NULL;
+        }
+        else {
+            gk_print_log("Failed to open file %s for saving residue eta values.\n",
+                eta_dat->fnames[eETA_CURVE]);
+        }
+    }
+    // residue x window eta matrix, binary (see save_eta in ensemble_res_comp.h)
+    if (eta_dat->eta_window) {
+        FILE *f = fopen(eta_dat->fnames[eETA_WINDOW], "wb");
+
+        if (f) {
+            int32_t head[5] = {eta_dat->nres, eta_dat->nwindows, eta_dat->window,
+                               eta_dat->window_step, eta_dat->window_ref ? 1 : 0};
+            int n = eta_dat->nres * eta_dat->nwindows;
+            int32_t *ids;
+            float *eta;
+            gk_print_log("Saving sliding window eta values to %s...\n",
+                eta_dat->fnames[eETA_WINDOW]);
+
+            snew(ids, eta_dat->nres);
+            snew(eta, n);
+            for (int i = 0; i < eta_dat->nres; ++i) {
+                ids[i] = eta_dat->res_IDs[i];
+            }
+            for (int p = 0; p < n; ++p) {
+                eta[p] = eta_dat->eta_window[p];
+            }
+            if (fwrite("ETAW", 1, 4, f) != 4 ||
+                fwrite(head, sizeof(int32_t), 5, f) != 5 ||
+                fwrite(ids, sizeof(int32_t), eta_dat->nres, f) != (size_t)eta_dat->nres ||
+                fwrite(eta, sizeof(float), n, f) != (size_t)n) {
+                gk_print_log("Failed to write sliding window eta values to %s.\n",
+                    eta_dat->fnames[eETA_WINDOW]);
+            }
+            sfree(ids);
+            sfree(eta);
+
+            fclose(f);
+            f = NULL;
+        }
+        else {
+            gk_print_log("Failed to open file %s for saving sliding window eta values.\n",
+                eta_dat->fnames[eETA_WINDOW]);
+        }
+    }
+    // kernel cache statistics
+    if (eta_dat->res_info && eta_dat->fnames[eCACHE_STATS] != NULL) {
+        FILE *f = fopen(eta_dat->fnames[eCACHE_STATS], "w");
+
+        if (f) {
+            long hits = 0, misses = 0;
+            gk_print_log("Saving kernel cache statistics to %s...\n",
+                eta_dat->fnames[eCACHE_STATS]);
+
+            fprintf(f, "# RES\tHITS\tMISSES\tEVICTIONS\tHIT_RATE\tKEPT\tDROPPED_MASS\tITERATIONS\tINSTANCES\n");
+            for (int i = 0; i < eta_dat->nres; ++i) {
+                struct svm_solve_info *info = &eta_dat->res_info[i];
+                long requests = info->cache_hits + info->cache_misses;
+                fprintf(f, "%d%s\t%ld\t%ld\t%ld\t%f\t%f\t%g\t%ld\t%d\n", eta_dat->res_IDs[i],
+                                                   eta_dat->res_names[i],
+                                                   info->cache_hits,
+                                                   info->cache_misses,
+                                                   info->cache_evictions,
+                                                   requests > 0 ? info->cache_hits / (double)requests : 0.0,
+                                                   info->kept_fraction,
+                                                   info->dropped_mass,
+                                                   info->iterations,
+                                                   info->instances);
+                hits += info->cache_hits;
+                misses += info->cache_misses;
+            }
+            gk_print_log("Overall kernel cache hit rate: %f\n",
+                hits + misses > 0 ? hits / (double)(hits + misses) : 0.0);
+
+            fclose(f);
+            f = NULL;
+        }
+        else {
+            gk_print_log("Failed to open file %s for saving kernel cache statistics.\n",
+                eta_dat->fnames[eCACHE_STATS]);
+        }
+    }
+    gk_flush_log();
 }
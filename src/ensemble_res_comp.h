@@ -3,8 +3,10 @@
 
 #include <math.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include "macros.h"
 #include "smalloc.h"
@@ -27,7 +29,7 @@
 #define COST 100.0 // default C parameter for svm_train
 
 /* Indices of filenames */
-enum {eTRAJ1, eTRAJ2, eNDX1, eNDX2, eRES1, eETA_RES, eNUMFILES};
+enum {eTRAJ1, eTRAJ2, eNDX1, eNDX2, eRES1, eETA_RES, eETA_SWEEP, eCACHE_STATS, eETA_COARSE, eETA_CURVE, eETA_WINDOW, eNUMFILES};
 
 /** Struct for holding eta data */
 typedef struct {
@@ -38,6 +40,82 @@ typedef struct {
     real c;
     int nthreads;
     output_env_t oenv;
+    // comma-separated gamma and C values to sweep, or NULL.
+    // If either is set, eta is computed at every (gamma, C) pair
+    // instead of only at gamma and c.
+    const char *gamma_grid;
+    const char *c_grid;
+    // libsvm kernel cache storage, CACHE_FLOAT, CACHE_FP16 or CACHE_BF16.
+    // With a half precision cache, ncheck residues are re-trained with
+    // a float cache to report whether eta changed.
+    int cache_type;
+    int ncheck;
+    // libsvm kernel cache replacement, CACHE_LRU, CACHE_LFU or CACHE_SV.
+    int cache_policy;
+    // run most SMO iterations on a float gradient, then finish in double.
+    gmx_bool mixed_precision;
+    // kernel entries with |K| below this are dropped from the cache, 0 keeps all.
+    // Needs cache_type CACHE_FLOAT. Not used by the (gamma, C) sweep.
+    real kernel_drop;
+    // split each residue into this many frame clusters and solve them first, 0 = off.
+    int dc_clusters;
+    // train first on the frames with a frame of the other ensemble among their
+    // sv_screen nearest neighbours, then add KKT violators, 0 = off. Not with dc_clusters.
+    int sv_screen;
+    // start each residue from the solution of the previous residue in the chain.
+    // With ncheck > 0, ncheck warm started residues are also trained from zero.
+    gmx_bool warm_start;
+    // approximate eta with a linear SVM on this many random Fourier features, 0 = exact.
+    int approx_dim;
+    // train a linear SVM on every residue first, and the RBF SVM only on residues
+    // whose linear eta reaches this, 0 = off. The others keep the linear eta, unless
+    // any of ncheck of them trained with the RBF kernel reaches this; then all are trained.
+    real linear_screen;
+    // skip training residues whose moment estimate (see moment_eta_probs) is below this, 0 = off.
+    // ncheck of them are trained first, and if any exceeds its estimate, all residues are trained.
+    // Skipped residues take the estimate as their eta. Like linear_screen, not used by the (gamma, C) sweep or approx_dim.
+    real moment_screen;
+    // first train every residue to this tolerance, 0 = off. Then only residues whose
+    // coarse eta reaches refine_eta or is among the refine_top largest are trained to
+    // the full tolerance, starting from their coarse solution.
+    real coarse_eps;
+    real refine_eta;
+    int refine_top;
+    // stop training a residue after this many SMO iterations or seconds, and all
+    // training deadline seconds after the start of the run, 0 = no limit. A stopped
+    // residue keeps its current nsv. Not used by the (gamma, C) sweep or approx_dim.
+    int max_iter;
+    real max_time;
+    real deadline;
+    // train identical frames of an ensemble as one instance with a multiple of C.
+    // Not used by the (gamma, C) sweep or approx_dim.
+    gmx_bool collapse_duplicates;
+    // train this many k-center representatives per ensemble instead of the frames, 0 = off.
+    // ncheck (at least 1) residues are also trained with all frames to estimate the effect.
+    int coreset;
+    // keep this fraction of every residue's effective sample size when choosing a frame stride
+    // from the autocorrelation times of the trajectories, 0 = off.
+    real ess_keep;
+    // train each residue on this many nested frame subsets, each twice as large as the one before
+    // and the last one all frames, until eta changes by less than curve_tol. 0 = off.
+    int curve_sizes;
+    real curve_tol;
+    // retrain each residue on this many bootstrap resamples of its frames for a 95% interval of eta, 0 = off.
+    // Frames are resampled in blocks of boot_block consecutive frames.
+    int nboot;
+    int boot_block;
+    // retrain each residue with this many permutations of the trajectory labels of its frames,
+    // in blocks of boot_block consecutive frames, for a p-value of eta. 0 = off.
+    // Permutations and the observed eta are solved to the full tolerance on all frames,
+    // without the coarse tolerance, the budgets or the coreset.
+    int nperm;
+    // train windows of this many consecutive frames of trajectory 1 against the same frames of
+    // trajectory 2, starting every window_step frames (0 = half a window). 0 = off.
+    // With window_ref, every window is trained against the same window frames spread
+    // evenly over all of trajectory 2 instead.
+    int window;
+    int window_step;
+    gmx_bool window_ref;
 
     // eta output for atoms
     int natoms; // number of atoms
@@ -48,7 +126,29 @@ typedef struct {
     int *res_IDs; // array of residue IDs. size = nres
     const char **res_names; // names of the residues. array size = nres
     int *res_natoms; // number of atoms per residue. array size = nres
-    real *eta; // eta value of each residue. array size = nres
+    real *eta; // eta value of each residue, the moment estimate if skipped by moment_screen. array size = nres
+    real *eta_err; // error indicator of each approximate eta, NULL unless approx_dim is set. array size = nres
+    gmx_bool *eta_linear; // TRUE where eta is from the linear pre-screen, NULL unless linear_screen is set. array size = nres
+    real *eta_moment; // moment estimate of eta of each residue, NULL unless moment_screen is set. array size = nres
+    gmx_bool *eta_refined; // TRUE where eta is from the full tolerance, NULL unless coarse_eps is set. array size = nres
+    struct svm_solve_info *res_info; // kernel cache statistics of each residue, only if fnames[eCACHE_STATS], kernel_drop, warm_start, a budget or coreset is set. array size = nres
+    real *tau; // integrated autocorrelation time of each residue in frames, NULL unless ess_keep is set. array size = nres
+    int stride; // frames were thinned to every stride-th frame before training
+    int *curve_frames; // frames per trajectory of each subset of a learning curve. array size = curve_sizes
+    real *eta_curve; // eta of residue r on subset s is eta_curve[r * curve_sizes + s], -1 if not trained
+    gmx_bool *eta_converged; // TRUE where eta settled before the last subset, NULL unless curve_sizes is set. array size = nres
+    real *eta_lo; // lower end of the bootstrap interval of each residue, -1 if not trained, NULL unless nboot is set. array size = nres
+    real *eta_hi; // upper end of the bootstrap interval of each residue, -1 if not trained, NULL unless nboot is set. array size = nres
+    real *eta_pvalue; // permutation p-value of each residue, -1 if not trained, NULL unless nperm is set. array size = nres
+    int nwindows; // number of windows of a sliding window run
+    real *eta_window; // eta of residue r in window w is eta_window[r * nwindows + w], NULL unless window is set
+
+    // eta output for a (gamma, C) sweep
+    int ngamma; // number of gamma values
+    real *gammas; // swept gamma values. array size = ngamma
+    int nc; // number of C values
+    real *cs; // swept C values. array size = nc
+    real *eta_sweep; // eta of residue r at gammas[g] and cs[c] is eta_sweep[(r * ngamma + g) * nc + c]
 
     // the following values may or may not be set, and are used
     // internally by ensemble_comp.
@@ -104,34 +204,189 @@ void free_svm_probs(struct svm_problem *probs,
 /* Frees the memory allocated in traj2svm_probs.
  */
 
+void init_svm_param(struct svm_parameter *param, real gamma, real c);
+/* Sets the default svm training parameters with the given gamma and c parameters.
+ */
+
 void train_svm_probs(struct svm_problem *probs,
                      int num_probs,
-                     real gamma,
-                     real c,
+                     const struct svm_parameter *param,
                      int nthreads,
-                     struct svm_model **models);
-/* Calls libsvm's svm_train function with default parameters and given gamma and c parameters.
+                     int *nsv,
+                     struct svm_solve_info *info,
+                     gmx_bool warm_start,
+                     float **alphas);
+/* Calls libsvm's svm_train_nsv function with the given parameters (see init_svm_param).
  * You can use traj2svm_probs to generate svm_problems.
- * Results are stored in models.
- * Memory for models must be pre-allocated as an array of pointers with length = num_probs.
+ * The number of support vectors of each problem is stored in nsv.
+ * Memory for nsv must be pre-allocated with length = num_probs.
+ * If info is not NULL, the kernel cache statistics of each problem are stored in it (length = num_probs).
+ * If warm_start is set, problems are trained in chains of consecutive problems,
+ * and each problem in a chain starts from the solution of the one before it.
+ * The problems must then be over the same frames, as the residues of traj_res2svm_probs are.
+ * If alphas is not NULL, problem i starts from alphas[i] where that is not NULL, and its
+ * solution is stored in alphas[i], which is allocated with length probs[i].l if needed.
  * nthreads is the number of threads to be used if ensemble_comp was built using openmp.
  * nthreads <= 0 will use all available threads.
  */
 
-void free_svm_models(struct svm_model **models, int num_models);
-/* Frees the memory allocated in train_svm_probs.
+void approx_svm_probs(struct svm_problem *probs,
+                      int num_probs,
+                      const struct svm_parameter *param,
+                      int ndim,
+                      int nthreads,
+                      int *nsv,
+                      int *nsv_alt);
+/* Approximates train_svm_probs with libsvm's svm_train_nsv_rff, which trains a linear SVM
+ * on ndim random Fourier features of the RBF kernel in time linear in the number of frames.
+ * Each problem is trained with two independent feature draws, and the numbers of
+ * support vectors are stored in nsv and nsv_alt (each of length num_probs).
+ * Their difference shows how much the estimate depends on the random features.
+ */
+
+void moment_eta_probs(struct svm_problem *probs,
+                      int num_probs,
+                      int nthreads,
+                      real *estimate);
+/* Fits a Gaussian to each ensemble of each problem from the mean and covariance of its
+ * frames, and stores sqrt(1 - BC^2) in estimate, where BC is the Bhattacharyya coefficient
+ * of the two Gaussians. This is the total variation bound of the fitted Gaussians, used as
+ * an estimate of eta. One pass over the frames, far cheaper than training. Real ensembles
+ * are not Gaussian, so the estimate can be too low for some residues (see check_moment_eta).
+ */
+
+void linear_svm_probs(struct svm_problem *probs,
+                      int num_probs,
+                      const struct svm_parameter *param,
+                      int nthreads,
+                      int *nsv);
+/* Like train_svm_probs, but trains a linear SVM on the atom coordinates with libsvm's
+ * svm_train_nsv_linear, ignoring the kernel of param. Much cheaper than the RBF SVM.
+ * Its eta is a quick screen; it is usually, but not always, below the RBF eta.
+ */
+
+void sweep_svm_probs(struct svm_problem *probs,
+                     int num_probs,
+                     const struct svm_parameter *param,
+                     int ngamma,
+                     real *gammas,
+                     int nc,
+                     real *cs,
+                     int nthreads,
+                     int *nsv);
+/* Trains every problem at each (gamma, C) pair of the given grids with libsvm's svm_sweep_nsv.
+ * The other training parameters are taken from param.
+ * Distance data is shared between gamma values and each C value warm-starts from the previous one,
+ * which is much cheaper than calling train_svm_probs once per pair.
+ * When the distance matrices fit in the kernel cache, they are built for one residue per thread at a time
+ * from a frame-major block of the group's coordinates (see svm_frame_block_create in svm.h).
+ * The number of support vectors of problem i at gammas[g] and cs[c] is stored in nsv[(i * ngamma + g) * nc + c].
+ * Memory for nsv must be pre-allocated with length = num_probs * ngamma * nc.
+ */
+
+void curve_svm_probs(struct svm_problem *probs,
+                     int num_probs,
+                     const struct svm_parameter *param,
+                     int nframes,
+                     int nsizes,
+                     real tol,
+                     int nthreads,
+                     int *nsv);
+/* Trains every problem of traj_res2svm_probs on nested subsets of its frames: every
+ * 2^(nsizes - 1)-th frame of each trajectory, then every 2^(nsizes - 2)-th, and so on
+ * up to all nframes frames. Each subset starts from the solution on the one before it,
+ * so the curve costs little more than its largest solve. A problem stops growing once
+ * its eta changes by less than tol between consecutive subsets.
+ * The number of support vectors of problem i on subset s is stored in nsv[i * nsizes + s],
+ * or -1 if the subset was not trained. Memory for nsv must be pre-allocated with
+ * length = num_probs * nsizes.
+ */
+
+void boot_svm_probs(struct svm_problem *probs,
+                    const int *res,
+                    int num_probs,
+                    const struct svm_parameter *param,
+                    int nframes,
+                    int nboot,
+                    int block,
+                    int nthreads,
+                    float **alphas,
+                    int *nsv);
+/* Trains every problem of traj_res2svm_probs on nboot block bootstrap resamples of its frames.
+ * Each resample draws blocks of block consecutive frames with replacement from each
+ * trajectory until it has nframes frames again. Frames drawn more than once are trained
+ * as one frame with a multiple of C (see collapse_duplicates in svm.h), and each resample
+ * starts from alphas[i], the solution on all frames, where that is not NULL.
+ * The problems are trained one at a time, with the resamples in parallel. If the kernel
+ * matrix of a problem fits as in perm_svm_probs, it is computed once and every resample
+ * reads its rows (see svm_train_nsv_kernel_rows). The resamples of problem i are seeded
+ * by its residue index res[i], so they are the same whichever residues are resampled.
+ * The number of support vectors of problem i on resample b, counting every copy of a frame,
+ * is stored in nsv[i * nboot + b]. Memory for nsv must be pre-allocated with length = num_probs * nboot.
+ */
+
+void perm_svm_probs(struct svm_problem *probs,
+                    const int *res,
+                    int num_probs,
+                    const struct svm_parameter *param,
+                    int nframes,
+                    int nperm,
+                    int block,
+                    int nthreads,
+                    int *nsv,
+                    int *nsv_obs);
+/* Trains every problem of traj_res2svm_probs with nperm random permutations of its labels.
+ * Frames are split into blocks of block consecutive frames of a trajectory, and the
+ * blocks are shuffled between the two trajectories. The problems are trained one at a
+ * time, with the permutations in parallel. If the kernel matrix of a problem fits in the
+ * kernel cache memory of all threads together, it is computed once with libsvm's
+ * svm_kernel_matrix and shared by all permutations (see svm_train_nsv_kernel). The
+ * observed labels are trained the same way, so param should only hold the options that
+ * svm_train_nsv_kernel uses. The permutations of problem i are seeded by its residue
+ * index res[i], so they are the same whichever residues are tested.
+ * The number of support vectors of problem i with permutation k is stored in nsv[i * nperm + k],
+ * and with the observed labels in nsv_obs[i]. Memory for nsv and nsv_obs must be
+ * pre-allocated with length num_probs * nperm and num_probs.
+ */
+
+void window_svm_probs(struct svm_problem *probs,
+                      int num_probs,
+                      const struct svm_parameter *param,
+                      int nframes,
+                      int window,
+                      int step,
+                      gmx_bool reference,
+                      int nthreads,
+                      int *nsv);
+/* Trains every problem of traj_res2svm_probs on sliding windows of its frames. Window k holds
+ * frames [k * step, k * step + window) of trajectory 1, and either the same frames of
+ * trajectory 2 or, if reference is set, window frames spread evenly over all of trajectory 2.
+ * Each thread trains the windows of one problem in order, and each window starts from the
+ * solution of the one before it. If the kernel matrix of a window fits in the kernel cache,
+ * the entries of frame pairs shared with the previous window are copied from its matrix
+ * (see svm_kernel_matrix_from), and only those of new frames are computed.
+ * The number of support vectors of problem i in window k is stored in nsv[i * nwindows + k],
+ * with nwindows = (nframes - window) / step + 1. Memory for nsv must be pre-allocated with
+ * length = num_probs * nwindows.
  */
 
-void calc_eta(struct svm_model **models,
-              int num_models,
+void calc_eta(int *nsv,
+              int num_probs,
               int num_frames,
               real *eta);
-/* Calculates discriminability (eta) values from the number of support vectors in the given svm models
+/* Calculates discriminability (eta) values from the given numbers of support vectors
  * and the given number of frames in each trajectory.
  */
 
 void save_eta(eta_res_dat_t *eta_dat);
 /* Saves the given discriminability (eta) values in a text file with the given name.
+ * If a (gamma, C) sweep was run, its eta table is saved to fnames[eETA_SWEEP].
+ * If a learning curve was run, eta against the number of frames is saved to fnames[eETA_CURVE].
+ * If sliding windows were trained, their eta is saved to fnames[eETA_WINDOW] in binary, in the
+ * byte order of the machine: the characters "ETAW", then the 32-bit integers nres, nwindows,
+ * window, window_step and window_ref, the nres residue IDs as 32-bit integers, and
+ * eta_window as nres * nwindows 32-bit floats, one row of windows per residue.
+ * If kernel cache statistics were collected, they are saved to fnames[eCACHE_STATS].
  */
 
 #endif // ENSEMBLE_RES_COMP_H
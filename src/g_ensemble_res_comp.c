@@ -17,31 +17,84 @@ int main(int argc, char *argv[]) {
         {efNDX, "-n1", "index1.ndx", ffOPTRD},
         {efNDX, "-n2", "index2.ndx", ffOPTRD},
         {efSTX, "-res", "res.pdb", ffREAD}, // provides residue information
-        {efDAT, "-eta", "eta.dat", ffWRITE} // output
+        {efDAT, "-eta", "eta.dat", ffWRITE}, // output
+        {efDAT, "-sweep", "eta_sweep.dat", ffOPTWR}, // output of a gamma/C sweep
+        {efDAT, "-cstats", "cache_stats.dat", ffOPTWR}, // kernel cache statistics per residue
+        {efDAT, "-coarse", "eta_coarse.dat", ffOPTWR}, // provisional eta of -ceps
+        {efDAT, "-curve", "eta_curve.dat", ffOPTWR}, // eta against the number of frames of -lcurve
+        {efDAT, "-wout", "eta_window.dat", ffOPTWR} // binary residue x window eta matrix of -window
     };
 
+    const char *kcache[] = {NULL, "float", "fp16", "bf16", NULL};
+    const char *kpolicy[] = {NULL, "lru", "lfu", "sv", NULL};
+
     t_pargs pa[] = {
         {"-g", FALSE, etREAL, {&eta_res_dat.gamma}, "RBD Kernel width (default=0.4)"},
         {"-c", FALSE, etREAL, {&eta_res_dat.c}, "Max value of Lagrange multiplier (default=100)"},
+        {"-gsweep", FALSE, etSTR, {&eta_res_dat.gamma_grid}, "Comma-separated gamma values to sweep, e.g. 0.1,0.4,1"},
+        {"-csweep", FALSE, etSTR, {&eta_res_dat.c_grid}, "Comma-separated C values to sweep, e.g. 1,10,100"},
+        {"-kcache", FALSE, etENUM, {kcache}, "Kernel cache storage. fp16 and bf16 hold twice as many columns but can change eta"},
+        {"-kpolicy", FALSE, etENUM, {kpolicy}, "Kernel cache replacement: least recently used, least frequently used, or keep free support vector columns"},
+        {"-kcheck", FALSE, etINT, {&eta_res_dat.ncheck}, "Number of residues re-trained with a float cache to check -kcache fp16/bf16, in double precision to check -mixed, from zero to check -warm, or trained to check -linscreen, -mscreen or -coreset"},
+        {"-kdrop", FALSE, etREAL, {&eta_res_dat.kernel_drop}, "Drop kernel entries below this from the cache and gradient updates, 0 keeps all. For well separated residues at large gamma"},
+        {"-dc", FALSE, etINT, {&eta_res_dat.dc_clusters}, "Split each residue's frames into this many kernel k-means clusters and solve those first to warm-start training (0 = off). For large ensembles"},
+        {"-screen", FALSE, etINT, {&eta_res_dat.sv_screen}, "Train first on frames with a frame of the other ensemble among this many nearest neighbours, then add the frames that violate the optimality conditions (0 = off)"},
+        {"-warm", FALSE, etBOOL, {&eta_res_dat.warm_start}, "Start each residue from the solution of the previous one, training residues in chains of 8 per thread"},
+        {"-approx", FALSE, etINT, {&eta_res_dat.approx_dim}, "Approximate eta with a linear SVM on this many random Fourier features of the RBF kernel (0 = exact). For quick screening of large ensembles"},
+        {"-linscreen", FALSE, etREAL, {&eta_res_dat.linear_screen}, "Train a linear SVM on every residue first, and the RBF SVM only where the linear eta reaches this (0 = off). Other residues keep the linear eta, flagged in the output, unless -kcheck of them reach it with the RBF kernel"},
+        {"-mscreen", FALSE, etREAL, {&eta_res_dat.moment_screen}, "Skip training residues whose separability estimate from Gaussian fits of the ensembles is below this (0 = off), unless -kcheck of them exceed their estimate when trained. Skipped residues take the estimate as eta, flagged in the output"},
+        {"-ceps", FALSE, etREAL, {&eta_res_dat.coarse_eps}, "Train every residue to this tolerance first (0 = off), then only refine residues selected by -refine and -rtop"},
+        {"-refine", FALSE, etREAL, {&eta_res_dat.refine_eta}, "With -ceps, refine residues whose coarse eta is at least this"},
+        {"-rtop", FALSE, etINT, {&eta_res_dat.refine_top}, "With -ceps, also refine this many residues with the largest coarse eta"},
+        {"-maxit", FALSE, etINT, {&eta_res_dat.max_iter}, "Stop training a residue after this many SMO iterations (0 = no limit). Its eta is then flagged as not converged"},
+        {"-rtime", FALSE, etREAL, {&eta_res_dat.max_time}, "Stop training a residue after this many seconds (0 = no limit)"},
+        {"-deadline", FALSE, etREAL, {&eta_res_dat.deadline}, "Stop all training this many seconds after the start of the run (0 = no limit)"},
+        {"-dedup", FALSE, etBOOL, {&eta_res_dat.collapse_duplicates}, "Train identical frames of an ensemble as one weighted frame. For rigid residues in PDB ensembles"},
+        {"-coreset", FALSE, etINT, {&eta_res_dat.coreset}, "Train this many k-center representatives of each ensemble per residue instead of all frames (0 = off). For long, correlated trajectories; needs -kcheck"},
+        {"-ess", FALSE, etREAL, {&eta_res_dat.ess_keep}, "Stride the trajectories by as many frames as keeps this fraction of every residue's effective sample size, from their autocorrelation times (0 = off, e.g. 0.9)"},
+        {"-lcurve", FALSE, etINT, {&eta_res_dat.curve_sizes}, "Train each residue on this many nested frame subsets, doubling up to all frames, and stop once eta settles (0 = off). Checks whether the ensembles have enough frames"},
+        {"-ltol", FALSE, etREAL, {&eta_res_dat.curve_tol}, "With -lcurve, eta has settled when it changes by less than this between subsets"},
+        {"-boot", FALSE, etINT, {&eta_res_dat.nboot}, "Retrain each residue on this many bootstrap resamples of its frames and add a 95% interval of eta to the output (0 = off)"},
+        {"-bblock", FALSE, etINT, {&eta_res_dat.boot_block}, "With -boot or -perm, resample or permute blocks of this many consecutive frames. Should be about the autocorrelation time of the trajectories (see -ess)"},
+        {"-perm", FALSE, etINT, {&eta_res_dat.nperm}, "Retrain each residue with this many permutations of the trajectory labels and add the p-value of eta to the output (0 = off)"},
+        {"-window", FALSE, etINT, {&eta_res_dat.window}, "Train windows of this many consecutive frames of the two trajectories against each other along the trajectories, instead of all frames (0 = off)"},
+        {"-wstep", FALSE, etINT, {&eta_res_dat.window_step}, "With -window, start a window every this many frames (0 = half a window)"},
+        {"-wref", FALSE, etBOOL, {&eta_res_dat.window_ref}, "With -window, train each window of trajectory 1 against frames spread over all of trajectory 2"},
+        {"-mixed", FALSE, etBOOL, {&eta_res_dat.mixed_precision}, "Run most SVM iterations in single precision and finish in double precision"},
         {"-nthreads", FALSE, etINT, {&eta_res_dat.nthreads}, "set the number of parallel threads to use (default is max available)"}
     };
 
     parse_common_args(&argc, argv, 0, eNUMFILES, fnm, asize(pa), pa, asize(desc), desc, 0, NULL, &eta_res_dat.oenv);
 
+    if (strcmp(kcache[0], "fp16") == 0)
+        eta_res_dat.cache_type = CACHE_FP16;
+    else if (strcmp(kcache[0], "bf16") == 0)
+        eta_res_dat.cache_type = CACHE_BF16;
+
+    if (strcmp(kpolicy[0], "lfu") == 0)
+        eta_res_dat.cache_policy = CACHE_LFU;
+    else if (strcmp(kpolicy[0], "sv") == 0)
+        eta_res_dat.cache_policy = CACHE_SV;
+
     eta_res_dat.fnames[eTRAJ1] = opt2fn("-f1", eNUMFILES, fnm);
     eta_res_dat.fnames[eTRAJ2] = opt2fn("-f2", eNUMFILES, fnm);
     eta_res_dat.fnames[eNDX1] = opt2fn_null("-n1", eNUMFILES, fnm);
     eta_res_dat.fnames[eNDX2] = opt2fn_null("-n2", eNUMFILES, fnm);
     eta_res_dat.fnames[eRES1] = opt2fn_null("-res", eNUMFILES, fnm);
     eta_res_dat.fnames[eETA_RES] = opt2fn("-eta", eNUMFILES, fnm);
+    eta_res_dat.fnames[eETA_SWEEP] = opt2fn("-sweep", eNUMFILES, fnm);
+    eta_res_dat.fnames[eCACHE_STATS] = opt2fn_null("-cstats", eNUMFILES, fnm);
+    eta_res_dat.fnames[eETA_COARSE] = opt2fn_null("-coarse", eNUMFILES, fnm);
+    eta_res_dat.fnames[eETA_CURVE] = opt2fn("-curve", eNUMFILES, fnm);
+    eta_res_dat.fnames[eETA_WINDOW] = opt2fn("-wout", eNUMFILES, fnm);
 
     // Calculate and output eta
     ensemble_res_comp(&eta_res_dat);
     save_eta(&eta_res_dat);
     free_eta_dat(&eta_res_dat);
 
-    print_log("%s completed successfully.\n", argv[0]);
-    close_log();
+    gk_print_log("%s completed successfully.\n", argv[0]);
+    gk_close_log();
 
     return 0;
 }